@@ -0,0 +1,44 @@
+#!/bin/bash
+
+# Runs data-parallel training with several worker processes on this machine. Every worker trains on a slice of
+# each batch; the gradients are summed with a ring all-reduce over local TCP connections (ring_port and up).
+# Rank 0 prints its output and writes the checkpoint and log file; the other ranks log to rank_<r>.log next to
+# the per-rank configs in a temporary directory, which is kept if a worker fails.
+
+if [ "$#" -ne 2 ] || ! [[ "$2" =~ ^[1-9][0-9]*$ ]]; then
+	echo "Usage: $0 <path_to_config_file> <num_workers>"
+	exit 1
+fi
+
+CONFIG_FILE=$1
+NUM_WORKERS=$2
+WORK_DIR=$(mktemp -d)
+
+for ((rank = 0; rank < NUM_WORKERS; rank++)); do
+	{
+		cat "$CONFIG_FILE"
+		echo
+		echo "world_size = $NUM_WORKERS"
+		echo "rank = $rank"
+	} > "$WORK_DIR/config_$rank.txt"
+done
+
+PIDS=()
+for ((rank = 1; rank < NUM_WORKERS; rank++)); do
+	./build/MnistModel "$WORK_DIR/config_$rank.txt" > "$WORK_DIR/rank_$rank.log" 2>&1 &
+	PIDS+=($!)
+done
+
+./build/MnistModel "$WORK_DIR/config_0.txt"
+STATUS=$?
+for ((i = 0; i < ${#PIDS[@]}; i++)); do
+	if ! wait "${PIDS[$i]}"; then
+		echo "Worker $((i + 1)) failed, see $WORK_DIR/rank_$((i + 1)).log"
+		STATUS=1
+	fi
+done
+
+if [ "$STATUS" -eq 0 ]; then
+	rm -rf "$WORK_DIR"
+fi
+exit $STATUS
@@ -0,0 +1,494 @@
+// Micro and macro benchmarks for the perceptron building blocks.
+//
+// Usage: perceptron_bench [--quick] [--filter <substring>] [--json <file>]
+//        perceptron_bench --compare <baseline.json> <candidate.json>
+//
+// Every benchmark prints one human-readable line and, with --json, one JSON object per line so that the results of
+// two builds can be compared with --compare. All input data is synthetic; the IDX files used by the loader and
+// epoch benchmarks are generated in the system temporary directory and removed afterwards.
+
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <filesystem>
+#include <fstream>
+#include <functional>
+#include <iostream>
+#include <map>
+#include <random>
+#include <sstream>
+#include <string>
+#include <vector>
+#include <unistd.h>
+#include "../Compute/Gemm.h"
+#include "../DataHandling.h"
+#include "../Memory/AllocationCounter.h"
+#include "../Network/Components.h"
+#include "../Network/Quantized.h"
+#include "../Training/BatchPipeline.h"
+#include "../Training/DataParallelTrainer.h"
+
+namespace {
+    struct Result {
+        std::string name;
+        std::string precision;
+        int batch = 0;
+        int hidden = 0;
+        double nsPerOp = 0;
+        double flopsPerOp = 0;
+        double samplesPerOp = 0;
+        double bytesPerOp = 0;
+        double allocationsPerOp = 0;
+
+        [[nodiscard]] std::string key() const {
+            return name + "/" + precision + "/b" + std::to_string(batch) + "/h" + std::to_string(hidden);
+        }
+    };
+
+    struct Options {
+        bool quick = false;
+        std::string filter;
+        std::string jsonPath;
+    };
+
+    // Runs op until at least minTime has passed, three times, and keeps the fastest repetition.
+    Result measure(const std::function<void()> &op, double minTime) {
+        using Clock = std::chrono::steady_clock;
+        op(); // warm-up, also sizes all buffers
+        Result best;
+        best.nsPerOp = -1;
+        for (int repetition = 0; repetition < 3; ++repetition) {
+            long long iterations = 1;
+            while (true) {
+                const Memory::AllocationStats allocationsStart = Memory::threadAllocations();
+                const auto start = Clock::now();
+                for (long long i = 0; i < iterations; ++i) {
+                    op();
+                }
+                const double seconds = std::chrono::duration<double>(Clock::now() - start).count();
+                const Memory::AllocationStats allocations = Memory::threadAllocations() - allocationsStart;
+                if (seconds >= minTime || iterations >= (1LL << 30)) {
+                    const double nsPerOp = seconds * 1e9 / static_cast<double>(iterations);
+                    if (best.nsPerOp < 0 || nsPerOp < best.nsPerOp) {
+                        best.nsPerOp = nsPerOp;
+                        best.bytesPerOp = static_cast<double>(allocations.bytes) / static_cast<double>(iterations);
+                        best.allocationsPerOp = static_cast<double>(allocations.count) / static_cast<double>(iterations);
+                    }
+                    break;
+                }
+                iterations *= 2;
+            }
+        }
+        return best;
+    }
+
+    class Bench {
+    public:
+        explicit Bench(Options options) : options(std::move(options)) {
+            if (!this->options.jsonPath.empty()) {
+                json.open(this->options.jsonPath);
+                if (!json) {
+                    throw std::runtime_error("Cannot create " + this->options.jsonPath);
+                }
+            }
+            std::printf("%-44s %14s %10s %14s %12s %10s\n", "benchmark", "ns/op", "GFLOP/s", "samples/s", "bytes/op",
+                        "allocs/op");
+        }
+
+        [[nodiscard]] bool quick() const { return options.quick; }
+
+        // Measures op unless the filter excludes it. flops and samples are per call of op.
+        void run(const std::string &name, const std::string &precision, int batch, int hidden, double flops,
+                 double samples, const std::function<void()> &op) {
+            Result probe{name, precision, batch, hidden};
+            if (!options.filter.empty() && probe.key().find(options.filter) == std::string::npos) {
+                return;
+            }
+            Result result = measure(op, options.quick ? 0.02 : 0.2);
+            result.name = name;
+            result.precision = precision;
+            result.batch = batch;
+            result.hidden = hidden;
+            result.flopsPerOp = flops;
+            result.samplesPerOp = samples;
+            report(result);
+        }
+
+    private:
+        Options options;
+        std::ofstream json;
+
+        void report(const Result &result) {
+            const double gflops = result.flopsPerOp / result.nsPerOp;
+            const double samplesPerSecond = result.samplesPerOp * 1e9 / result.nsPerOp;
+            std::printf("%-44s %14.1f %10.2f %14.0f %12.0f %10.2f\n", result.key().c_str(), result.nsPerOp, gflops,
+                        samplesPerSecond, result.bytesPerOp, result.allocationsPerOp);
+            std::fflush(stdout);
+            if (json) {
+                json << "{\"key\":\"" << result.key() << "\",\"name\":\"" << result.name << "\",\"precision\":\""
+                     << result.precision << "\",\"batch\":" << result.batch << ",\"hidden\":" << result.hidden
+                     << ",\"ns_per_op\":" << result.nsPerOp << ",\"gflops\":" << gflops
+                     << ",\"samples_per_s\":" << samplesPerSecond << ",\"bytes_allocated_per_op\":"
+                     << result.bytesPerOp << ",\"allocations_per_op\":" << result.allocationsPerOp << "}\n";
+            }
+        }
+    };
+
+    // Writes an IDX image/label file pair with MNIST-like sparsity.
+    void writeSyntheticIdx(const std::string &imagePath, const std::string &labelPath, int count) {
+        auto bigEndian = [](std::ofstream &file, std::uint32_t value) {
+            const std::uint32_t swapped = __builtin_bswap32(value);
+            file.write(reinterpret_cast<const char *>(&swapped), 4);
+        };
+        std::mt19937 generator(42);
+        std::uniform_int_distribution<int> pixel(0, 255);
+        std::uniform_int_distribution<int> label(0, 9);
+        std::bernoulli_distribution ink(0.2);
+
+        std::ofstream images(imagePath, std::ios::binary);
+        bigEndian(images, 2051);
+        bigEndian(images, count);
+        bigEndian(images, 28);
+        bigEndian(images, 28);
+        std::vector<unsigned char> image(28 * 28);
+        for (int i = 0; i < count; ++i) {
+            for (auto &value : image) {
+                value = ink(generator) ? static_cast<unsigned char>(pixel(generator)) : 0;
+            }
+            images.write(reinterpret_cast<const char *>(image.data()), static_cast<std::streamsize>(image.size()));
+        }
+
+        std::ofstream labels(labelPath, std::ios::binary);
+        bigEndian(labels, 2049);
+        bigEndian(labels, count);
+        for (int i = 0; i < count; ++i) {
+            const auto value = static_cast<unsigned char>(label(generator));
+            labels.write(reinterpret_cast<const char *>(&value), 1);
+        }
+    }
+
+    // Initialization stream of the first layer of a Network seeded with the default seed
+    Rng::Stream firstLayerStream() {
+        return Rng::Stream(Rng::defaultSeed).split(Rng::Purpose::Initialization).split(0);
+    }
+
+    template<typename T>
+    void benchLayers(Bench &bench, const std::string &precision, const std::vector<int> &batches,
+                     const std::vector<int> &hiddens) {
+        constexpr int inputs = 784;
+        for (int hidden : hiddens) {
+            Layer<T> layer(inputs, hidden, firstLayerStream());
+            auto gradients = layer.makeGradients();
+            for (int batch : batches) {
+                const MatrixT<T> input = MatrixT<T>::Random(batch, inputs).cwiseAbs();
+                MatrixT<T> output(batch, hidden);
+                const MatrixT<T> gradOutput = MatrixT<T>::Random(batch, hidden);
+                MatrixT<T> gradInput(batch, inputs);
+                const double flops = 2.0 * batch * inputs * hidden;
+                bench.run("layer_forward", precision, batch, hidden, flops, batch, [&] {
+                    layer.template forward<Activation::ReLU>(input, output);
+                });
+                bench.run("layer_backward", precision, batch, hidden, 2 * flops, batch, [&] {
+                    layer.backward(input, gradOutput, gradients, gradInput);
+                });
+            }
+        }
+    }
+
+    // Weight initialization of a first layer from the counter-based generator, which splits large layers across
+    // threads, and the shuffled visiting order of an MNIST-sized epoch. samples/s counts drawn values.
+    void benchRandom(Bench &bench, const std::vector<int> &hiddens) {
+        constexpr int inputs = 784;
+        std::vector<int> sizes = hiddens;
+        sizes.push_back(8192);
+        for (int hidden : sizes) {
+            const double values = static_cast<double>(inputs) * hidden;
+            bench.run("layer_init", "float", 0, hidden, 0, values, [&] {
+                const Layer<float> layer(inputs, hidden, firstLayerStream());
+            });
+        }
+        constexpr int count = 60000;
+        std::vector<int> order;
+        int epoch = 0;
+        bench.run("epoch_order", "int", count, 0, 0, count, [&] {
+            epochOrder(count, true, Rng::defaultSeed, epoch++, order);
+        });
+    }
+
+    // The three products of a layer with every GEMM backend the CPU supports: forward (batch x inputs times
+    // inputs x outputs), weight gradient (transposed input times output gradient) and input gradient (output
+    // gradient times transposed weights), for the first and the output layer.
+    void benchGemm(Bench &bench, const std::vector<int> &batches, const std::vector<int> &hiddens) {
+        const Compute::Backend previous = Compute::activeBackend();
+        for (Compute::Backend backend : {Compute::Backend::Eigen, Compute::Backend::Avx2, Compute::Backend::Avx512}) {
+            if (!Compute::supported(backend)) {
+                continue;
+            }
+            Compute::selectBackend(backend);
+            const std::string suffix = std::string("_") + Compute::backendName(backend);
+            for (int hidden : hiddens) {
+                for (const auto &[inputs, outputs] : {std::pair(784, hidden), std::pair(hidden, 10)}) {
+                    const std::string shape = "_" + std::to_string(inputs) + "x" + std::to_string(outputs);
+                    const MatrixT<float> weights = MatrixT<float>::Random(inputs, outputs);
+                    MatrixT<float> weightGradient(inputs, outputs);
+                    for (int batch : batches) {
+                        const MatrixT<float> input = MatrixT<float>::Random(batch, inputs);
+                        const MatrixT<float> gradOutput = MatrixT<float>::Random(batch, outputs);
+                        MatrixT<float> output(batch, outputs);
+                        MatrixT<float> gradInput(batch, inputs);
+                        const double flops = 2.0 * batch * inputs * outputs;
+                        bench.run("gemm_forward" + shape + suffix, "float", batch, hidden, flops, batch, [&] {
+                            Compute::multiply<float>(input, false, weights, false, output);
+                        });
+                        bench.run("gemm_weight_gradient" + shape + suffix, "float", batch, hidden, flops, batch, [&] {
+                            Compute::multiply<float>(input, true, gradOutput, false, weightGradient);
+                        });
+                        bench.run("gemm_input_gradient" + shape + suffix, "float", batch, hidden, flops, batch, [&] {
+                            Compute::multiply<float>(gradOutput, false, weights, true, gradInput);
+                        });
+                    }
+                }
+            }
+        }
+        Compute::selectBackend(previous);
+    }
+
+    // First-layer kernels on MNIST-like inputs at several densities: the dense GEMMs against the CSR conversion
+    // plus the sparse kernels. The crossover sets the default sparse_input_threshold. FLOPs are the dense ones.
+    template<typename T>
+    void benchSparseLayers(Bench &bench, const std::string &precision, const std::vector<int> &batches,
+                           const std::vector<int> &hiddens, const std::vector<double> &densities) {
+        constexpr int inputs = 784;
+        std::mt19937 generator(7);
+        std::uniform_real_distribution<T> uniform(0, 1);
+        for (int hidden : hiddens) {
+            Layer<T> layer(inputs, hidden, firstLayerStream());
+            layer.keepWeightsByInput(true);
+            auto gradients = layer.makeGradients();
+            for (int batch : batches) {
+                MatrixT<T> output(batch, hidden);
+                const MatrixT<T> gradOutput = MatrixT<T>::Random(batch, hidden);
+                MatrixT<T> gradientByInput(hidden, inputs);
+                VectorT<T> rowGradient(hidden);
+                SparseInput::CsrBatch<T> csr;
+                csr.reserve(batch, inputs);
+                const double flops = 2.0 * batch * inputs * hidden;
+                for (double density : densities) {
+                    const MatrixT<T> input = MatrixT<T>::NullaryExpr(batch, inputs, [&] {
+                        return uniform(generator) < density ? uniform(generator) : T(0);
+                    });
+                    const std::string suffix = "_d" + std::to_string(static_cast<int>(density * 100));
+                    bench.run("layer_forward_dense" + suffix, precision, batch, hidden, flops, batch, [&] {
+                        layer.template forward<Activation::ReLU>(input, output);
+                    });
+                    bench.run("layer_forward_sparse" + suffix, precision, batch, hidden, flops, batch, [&] {
+                        csr.assign(input, 1.0);
+                        layer.template forward<Activation::ReLU>(csr, output);
+                    });
+                    bench.run("layer_gradient_dense" + suffix, precision, batch, hidden, flops, batch, [&] {
+                        layer.backward(input, gradOutput, gradients);
+                    });
+                    csr.assign(input, 1.0);
+                    bench.run("layer_gradient_sparse" + suffix, precision, batch, hidden, flops, batch, [&] {
+                        layer.backward(csr, gradOutput, gradients, gradientByInput, rowGradient);
+                    });
+                }
+            }
+        }
+    }
+
+    // Inference of a 784-hidden-10 network on MNIST-like uint8 pixels: normalization plus the float forward pass
+    // against the int8-quantized network, which reads the pixels directly.
+    void benchQuantized(Bench &bench, const std::vector<int> &batches, const std::vector<int> &hiddens) {
+        constexpr int inputs = 784;
+        std::mt19937 generator(11);
+        std::uniform_int_distribution<int> pixel(0, 255);
+        std::bernoulli_distribution ink(0.2);
+        for (int hidden : hiddens) {
+            Network<float> network;
+            network.addLayer(inputs, hidden, Activation::ReLU{});
+            network.addLayer(hidden, 10, Activation::Identity{});
+            const QuantizedNetwork quantized(network);
+            for (int batch : batches) {
+                std::vector<std::uint8_t> pixels(static_cast<std::size_t>(batch) * inputs);
+                for (auto &value : pixels) {
+                    value = ink(generator) ? static_cast<std::uint8_t>(pixel(generator)) : 0;
+                }
+                using RawImages = Eigen::Matrix<std::uint8_t, Eigen::Dynamic, Eigen::Dynamic, Eigen::RowMajor>;
+                const Eigen::Map<const RawImages> raw(pixels.data(), batch, inputs);
+                MatrixT<float> images(batch, inputs);
+                auto workspace = network.makeWorkspace(batch);
+                auto quantizedWorkspace = quantized.makeWorkspace(batch);
+                const double flops = 2.0 * batch * (inputs * hidden + hidden * 10);
+                bench.run("inference", "float", batch, hidden, flops, batch, [&] {
+                    images = raw.cast<float>() / 255.0f;
+                    network.forward(images, workspace);
+                });
+                bench.run("inference", "int8", batch, hidden, flops, batch, [&] {
+                    quantized.forward(pixels.data(), batch, quantizedWorkspace);
+                });
+            }
+        }
+    }
+
+    void benchLoss(Bench &bench, const std::vector<int> &batches) {
+        for (int batch : batches) {
+            const Matrix logits = Matrix::Random(batch, 10);
+            Matrix predictions(batch, 10);
+            Matrix targets = Matrix::Zero(batch, 10);
+            for (int i = 0; i < batch; ++i) {
+                targets(i, i % 10) = 1;
+            }
+            Vector loss(batch);
+            bench.run("softmax", "double", batch, 0, 0, batch, [&] {
+                Activation::softmax<Precision>(logits, predictions);
+            });
+            Activation::softmax<Precision>(logits, predictions);
+            bench.run("cross_entropy", "double", batch, 0, 0, batch, [&] {
+                Loss::crossEntropy<Precision>(predictions, targets, loss);
+            });
+            Matrix gradient(batch, 10);
+            bench.run("softmax_cross_entropy", "double", batch, 0, 0, batch, [&] {
+                Loss::softmaxCrossEntropy<Precision>(logits, targets, gradient, loss);
+            });
+            bench.run("softmax_cross_entropy_no_loss", "double", batch, 0, 0, batch, [&] {
+                Loss::softmaxCrossEntropy<Precision>(logits, targets, gradient);
+            });
+        }
+    }
+
+    void benchLoader(Bench &bench, const std::string &imagePath, const std::string &labelPath, int count) {
+        bench.run("loader_load_images", "double", count, 0, 0, count, [&] {
+            MNISTLoader<> loader;
+            loader.loadImages(imagePath);
+        });
+        bench.run("loader_map_images", "double", count, 0, 0, count, [&] {
+            MNISTLoader<> loader;
+            loader.mapImages(imagePath);
+            loader.mapLabels(labelPath);
+        });
+        MNISTLoader<> loader;
+        loader.mapImages(imagePath);
+        constexpr int batch = 64;
+        Matrix images(batch, loader.imageSize());
+        int first = 0;
+        bench.run("loader_copy_batch", "double", batch, 0, 0, batch, [&] {
+            loader.copyImageBatch(first, batch, images);
+            first = (first + batch) % (count - batch);
+        });
+    }
+
+    template<typename T>
+    void benchEpoch(Bench &bench, const std::string &precision, const std::string &imagePath,
+                    const std::string &labelPath, const std::vector<int> &batches, const std::vector<int> &hiddens) {
+        MNISTLoader<T> loader;
+        loader.mapImages(imagePath);
+        loader.mapLabels(labelPath);
+        const int count = loader.imageCount();
+        for (int hidden : hiddens) {
+            for (int batch : batches) {
+                Network<T> network;
+                network.addLayer(loader.imageSize(), hidden, Activation::ReLU{});
+                network.addLayer(hidden, 10, Activation::Identity{});
+                DataParallelTrainer<T> trainer(network, 1, batch);
+                // forward + backward of both layers, without the unused first-layer input gradient
+                const double flops = 2.0 * count * (3.0 * hidden * 10 + 2.0 * loader.imageSize() * hidden);
+                bench.run("train_epoch", precision, batch, hidden, flops, count, [&] {
+                    BatchPipeline<T> pipeline(loader, batch, 0, 1, 4, true, 1);
+                    for (int i = 0; i < pipeline.batchesPerEpoch(); ++i) {
+                        const auto &data = pipeline.acquire();
+                        trainer.step(pipeline.images(data), pipeline.labels(data), T(0.001));
+                        pipeline.release();
+                    }
+                });
+            }
+        }
+    }
+
+    // Reads the key and ns_per_op fields of every line written with --json.
+    std::map<std::string, double> readResults(const std::string &path) {
+        std::ifstream file(path);
+        if (!file) {
+            throw std::runtime_error("Cannot open " + path);
+        }
+        std::map<std::string, double> results;
+        std::string line;
+        while (std::getline(file, line)) {
+            const auto keyStart = line.find("\"key\":\"");
+            const auto nsStart = line.find("\"ns_per_op\":");
+            if (keyStart == std::string::npos || nsStart == std::string::npos) {
+                continue;
+            }
+            const auto keyBegin = keyStart + 7;
+            const std::string key = line.substr(keyBegin, line.find('"', keyBegin) - keyBegin);
+            results[key] = std::stod(line.substr(nsStart + 12));
+        }
+        return results;
+    }
+
+    int compare(const std::string &baselinePath, const std::string &candidatePath) {
+        const auto baseline = readResults(baselinePath);
+        const auto candidate = readResults(candidatePath);
+        std::printf("%-44s %14s %14s %9s\n", "benchmark", "baseline ns", "candidate ns", "speedup");
+        for (const auto &[key, baselineNs] : baseline) {
+            const auto it = candidate.find(key);
+            if (it == candidate.end()) {
+                continue;
+            }
+            std::printf("%-44s %14.1f %14.1f %8.2fx\n", key.c_str(), baselineNs, it->second, baselineNs / it->second);
+        }
+        return 0;
+    }
+}
+
+int main(int argc, char *argv[]) {
+    Options options;
+    for (int i = 1; i < argc; ++i) {
+        const std::string argument = argv[i];
+        if (argument == "--quick") {
+            options.quick = true;
+        } else if (argument == "--filter" && i + 1 < argc) {
+            options.filter = argv[++i];
+        } else if (argument == "--json" && i + 1 < argc) {
+            options.jsonPath = argv[++i];
+        } else if (argument == "--compare" && i + 2 < argc) {
+            return compare(argv[i + 1], argv[i + 2]);
+        } else {
+            std::cout << "Usage: " << argv[0] << " [--quick] [--filter <substring>] [--json <file>]\n"
+                      << "       " << argv[0] << " --compare <baseline.json> <candidate.json>" << std::endl;
+            return 1;
+        }
+    }
+
+    try {
+        Bench bench(options);
+        const std::vector<int> batches = options.quick ? std::vector<int>{64} : std::vector<int>{16, 64, 256};
+        const std::vector<int> hiddens = options.quick ? std::vector<int>{128} : std::vector<int>{64, 128, 512};
+        const int datasetSize = options.quick ? 2048 : 10000;
+
+        const auto directory = std::filesystem::temp_directory_path() /
+                               ("perceptron_bench_" + std::to_string(::getpid()));
+        std::filesystem::create_directories(directory);
+        const std::string imagePath = (directory / "images.idx3-ubyte").string();
+        const std::string labelPath = (directory / "labels.idx1-ubyte").string();
+        writeSyntheticIdx(imagePath, labelPath, datasetSize);
+
+        benchLayers<double>(bench, "double", batches, hiddens);
+        benchLayers<float>(bench, "float", batches, hiddens);
+        benchGemm(bench, batches, hiddens);
+        benchSparseLayers<float>(bench, "float", batches, hiddens, {0.05, 0.1, 0.2, 0.3, 0.5});
+        benchQuantized(bench, batches, hiddens);
+        benchLoss(bench, batches);
+        benchRandom(bench, hiddens);
+        benchLoader(bench, imagePath, labelPath, datasetSize);
+        benchEpoch<double>(bench, "double", imagePath, labelPath, batches, hiddens);
+        benchEpoch<float>(bench, "float", imagePath, labelPath, batches, hiddens);
+
+        std::filesystem::remove_all(directory);
+    } catch (const std::exception &e) {
+        std::cerr << "Error: " << e.what() << std::endl;
+        return 1;
+    }
+    return 0;
+}
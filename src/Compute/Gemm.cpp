@@ -0,0 +1,468 @@
+#include "Gemm.h"
+
+#include <algorithm>
+#include <atomic>
+#include <stdexcept>
+#include <vector>
+
+#if (defined(__x86_64__) || defined(__i386__)) && (defined(__GNUC__) || defined(__clang__))
+#define PERCEPTRON_X86_KERNELS 1
+#include <immintrin.h>
+#endif
+
+// The SIMD micro-kernels are the only functions compiled for AVX2/AVX-512, through target attributes, so nothing
+// else in the binary (including template instantiations shared with other translation units) can pick up
+// instructions the running CPU may lack. The blocking and packing code is plain C++.
+
+namespace {
+    // Cache-blocked GEMM driver. op(B) is packed in kc x nc blocks that stay in L3 and op(A) in mc x kc blocks
+    // that stay in L2, both reordered into the panel layout the micro-kernel streams through, with edges
+    // zero-padded to whole panels. Kernel supplies the tile sizes and
+    //   static void run(int kc, const float *a, const float *b, float *c, int ldc, bool accumulate);
+    // which computes the mr x nr tile c (+)= a * b from an mr-wide A panel and an nr-wide B panel.
+    template<typename Kernel>
+    void blockedGemm(bool transposeA, bool transposeB, int m, int n, int k, const float *a, int lda, const float *b,
+                     int ldb, float *c, int ldc) {
+        constexpr int mr = Kernel::mr;
+        constexpr int nr = Kernel::nr;
+        if (m <= 0 || n <= 0) {
+            return;
+        }
+        if (k <= 0) {
+            for (int j = 0; j < n; ++j) {
+                std::fill_n(c + static_cast<long>(j) * ldc, m, 0.0f);
+            }
+            return;
+        }
+        auto elementA = [&](int i, int p) {
+            return transposeA ? a[p + static_cast<long>(i) * lda] : a[i + static_cast<long>(p) * lda];
+        };
+        auto elementB = [&](int p, int j) {
+            return transposeB ? b[j + static_cast<long>(p) * ldb] : b[p + static_cast<long>(j) * ldb];
+        };
+
+        // Grown on the first product of each thread, then reused
+        thread_local std::vector<float> packedA;
+        thread_local std::vector<float> packedB;
+        packedA.resize(std::max<std::size_t>(packedA.size(), static_cast<std::size_t>(Kernel::mc) * Kernel::kc));
+        packedB.resize(std::max<std::size_t>(packedB.size(), static_cast<std::size_t>(Kernel::kc) * Kernel::nc));
+        alignas(64) float edge[mr * nr];
+
+        for (int jc = 0; jc < n; jc += Kernel::nc) {
+            const int nc = std::min(Kernel::nc, n - jc);
+            for (int pc = 0; pc < k; pc += Kernel::kc) {
+                const int kc = std::min(Kernel::kc, k - pc);
+                const bool accumulate = pc > 0;
+
+                // B block: panels of nr columns, each stored as kc rows of nr values
+                for (int jr = 0; jr < nc; jr += nr) {
+                    float *panel = packedB.data() + static_cast<long>(jr) * kc;
+                    const int columns = std::min(nr, nc - jr);
+                    for (int p = 0; p < kc; ++p) {
+                        for (int j = 0; j < nr; ++j) {
+                            panel[p * nr + j] = j < columns ? elementB(pc + p, jc + jr + j) : 0.0f;
+                        }
+                    }
+                }
+
+                for (int ic = 0; ic < m; ic += Kernel::mc) {
+                    const int mc = std::min(Kernel::mc, m - ic);
+                    // A block: panels of mr rows, each stored as kc columns of mr values
+                    for (int ir = 0; ir < mc; ir += mr) {
+                        float *panel = packedA.data() + static_cast<long>(ir) * kc;
+                        const int rows = std::min(mr, mc - ir);
+                        if (!transposeA && rows == mr) {
+                            for (int p = 0; p < kc; ++p) {
+                                std::copy_n(a + (ic + ir) + static_cast<long>(pc + p) * lda, mr, panel + p * mr);
+                            }
+                        } else if (transposeA) {
+                            // Row i of op(A) is contiguous in memory; read it in order and scatter into the panel
+                            for (int i = 0; i < mr; ++i) {
+                                if (i < rows) {
+                                    const float *row = a + pc + static_cast<long>(ic + ir + i) * lda;
+                                    for (int p = 0; p < kc; ++p) {
+                                        panel[p * mr + i] = row[p];
+                                    }
+                                } else {
+                                    for (int p = 0; p < kc; ++p) {
+                                        panel[p * mr + i] = 0.0f;
+                                    }
+                                }
+                            }
+                        } else {
+                            for (int p = 0; p < kc; ++p) {
+                                for (int i = 0; i < mr; ++i) {
+                                    panel[p * mr + i] = i < rows ? elementA(ic + ir + i, pc + p) : 0.0f;
+                                }
+                            }
+                        }
+                    }
+
+                    for (int jr = 0; jr < nc; jr += nr) {
+                        const float *panelB = packedB.data() + static_cast<long>(jr) * kc;
+                        const int columns = std::min(nr, nc - jr);
+                        for (int ir = 0; ir < mc; ir += mr) {
+                            const float *panelA = packedA.data() + static_cast<long>(ir) * kc;
+                            const int rows = std::min(mr, mc - ir);
+                            float *tile = c + (ic + ir) + static_cast<long>(jc + jr) * ldc;
+                            if (rows == mr && columns == nr) {
+                                Kernel::run(kc, panelA, panelB, tile, ldc, accumulate);
+                                continue;
+                            }
+                            // Partial tile: compute the whole padded tile aside and copy the valid part
+                            Kernel::run(kc, panelA, panelB, edge, mr, false);
+                            for (int j = 0; j < columns; ++j) {
+                                for (int i = 0; i < rows; ++i) {
+                                    float &target = tile[i + static_cast<long>(j) * ldc];
+                                    target = accumulate ? target + edge[i + j * mr] : edge[i + j * mr];
+                                }
+                            }
+                        }
+                    }
+                }
+            }
+        }
+    }
+
+#ifdef PERCEPTRON_X86_KERNELS
+    // 16x6 tile in 12 ymm accumulators; two A loads and six broadcasts per step leave the FMA ports busy.
+    struct Avx2Kernel {
+        static constexpr int mr = 16;
+        static constexpr int nr = 6;
+        static constexpr int mc = 144;
+        static constexpr int kc = 256;
+        static constexpr int nc = 4092;
+
+        __attribute__((target("avx2,fma")))
+        static void run(int kc, const float *a, const float *b, float *c, int ldc, bool accumulate) {
+            __m256 sum[nr][2];
+#pragma GCC unroll 6
+            for (int j = 0; j < nr; ++j) {
+                sum[j][0] = _mm256_setzero_ps();
+                sum[j][1] = _mm256_setzero_ps();
+            }
+            for (int p = 0; p < kc; ++p) {
+                const __m256 a0 = _mm256_loadu_ps(a);
+                const __m256 a1 = _mm256_loadu_ps(a + 8);
+#pragma GCC unroll 6
+                for (int j = 0; j < nr; ++j) {
+                    const __m256 bj = _mm256_broadcast_ss(b + j);
+                    sum[j][0] = _mm256_fmadd_ps(a0, bj, sum[j][0]);
+                    sum[j][1] = _mm256_fmadd_ps(a1, bj, sum[j][1]);
+                }
+                a += mr;
+                b += nr;
+            }
+#pragma GCC unroll 6
+            for (int j = 0; j < nr; ++j) {
+                float *column = c + static_cast<long>(j) * ldc;
+                if (accumulate) {
+                    sum[j][0] = _mm256_add_ps(sum[j][0], _mm256_loadu_ps(column));
+                    sum[j][1] = _mm256_add_ps(sum[j][1], _mm256_loadu_ps(column + 8));
+                }
+                _mm256_storeu_ps(column, sum[j][0]);
+                _mm256_storeu_ps(column + 8, sum[j][1]);
+            }
+        }
+    };
+
+    // 32x12 tile in 24 zmm accumulators.
+    struct Avx512Kernel {
+        static constexpr int mr = 32;
+        static constexpr int nr = 12;
+        static constexpr int mc = 128;
+        static constexpr int kc = 256;
+        static constexpr int nc = 4092;
+
+        __attribute__((target("avx512f")))
+        static void run(int kc, const float *a, const float *b, float *c, int ldc, bool accumulate) {
+            __m512 sum[nr][2];
+#pragma GCC unroll 12
+            for (int j = 0; j < nr; ++j) {
+                sum[j][0] = _mm512_setzero_ps();
+                sum[j][1] = _mm512_setzero_ps();
+            }
+            for (int p = 0; p < kc; ++p) {
+                const __m512 a0 = _mm512_loadu_ps(a);
+                const __m512 a1 = _mm512_loadu_ps(a + 16);
+#pragma GCC unroll 12
+                for (int j = 0; j < nr; ++j) {
+                    const __m512 bj = _mm512_set1_ps(b[j]);
+                    sum[j][0] = _mm512_fmadd_ps(a0, bj, sum[j][0]);
+                    sum[j][1] = _mm512_fmadd_ps(a1, bj, sum[j][1]);
+                }
+                a += mr;
+                b += nr;
+            }
+#pragma GCC unroll 12
+            for (int j = 0; j < nr; ++j) {
+                float *column = c + static_cast<long>(j) * ldc;
+                if (accumulate) {
+                    sum[j][0] = _mm512_add_ps(sum[j][0], _mm512_loadu_ps(column));
+                    sum[j][1] = _mm512_add_ps(sum[j][1], _mm512_loadu_ps(column + 16));
+                }
+                _mm512_storeu_ps(column, sum[j][0]);
+                _mm512_storeu_ps(column + 16, sum[j][1]);
+            }
+        }
+    };
+#endif
+
+    // Int8 products in dot-product form: every output is the dot product of a row of A with a row of B, and a tile
+    // of rows x cols outputs keeps one accumulator register per output while both operands stream along k. Kernel
+    // supplies the tile sizes and
+    //   template<int R, int C> static void tile(int k, const uint8_t *a, int lda, const int8_t *b, int ldb,
+    //                                           int32_t *c, int ldc);
+    // for R <= rows and C <= cols.
+    template<typename Kernel, int R>
+    void int8Rows(int n, int k, const std::uint8_t *a, int lda, const std::int8_t *b, int ldb, std::int32_t *c,
+                  int ldc) {
+        int j = 0;
+        for (; j + Kernel::cols <= n; j += Kernel::cols) {
+            Kernel::template tile<R, Kernel::cols>(k, a, lda, b + static_cast<long>(j) * ldb, ldb, c + j, ldc);
+        }
+        for (; j < n; ++j) {
+            Kernel::template tile<R, 1>(k, a, lda, b + static_cast<long>(j) * ldb, ldb, c + j, ldc);
+        }
+    }
+
+    template<typename Kernel>
+    void int8Gemm(int m, int n, int k, const std::uint8_t *a, int lda, const std::int8_t *b, int ldb,
+                  std::int32_t *c, int ldc) {
+        int i = 0;
+        for (; i + Kernel::rows <= m; i += Kernel::rows) {
+            int8Rows<Kernel, Kernel::rows>(n, k, a + static_cast<long>(i) * lda, lda, b, ldb,
+                                           c + static_cast<long>(i) * ldc, ldc);
+        }
+        for (; i < m; ++i) {
+            int8Rows<Kernel, 1>(n, k, a + static_cast<long>(i) * lda, lda, b, ldb, c + static_cast<long>(i) * ldc,
+                                ldc);
+        }
+    }
+
+    struct ScalarInt8Kernel {
+        static constexpr int rows = 1;
+        static constexpr int cols = 4;
+
+        template<int R, int C>
+        static void tile(int k, const std::uint8_t *a, int lda, const std::int8_t *b, int ldb, std::int32_t *c,
+                         int ldc) {
+            for (int r = 0; r < R; ++r) {
+                for (int col = 0; col < C; ++col) {
+                    std::int32_t sum = 0;
+                    for (int p = 0; p < k; ++p) {
+                        sum += static_cast<std::int32_t>(a[r * lda + p]) * b[col * ldb + p];
+                    }
+                    c[r * ldc + col] = sum;
+                }
+            }
+        }
+    };
+
+#ifdef PERCEPTRON_X86_KERNELS
+    // 2x4 tile: 16 bytes of each operand widened to 16 bits per step, 8 accumulators.
+    struct Avx2Int8Kernel {
+        static constexpr int rows = 2;
+        static constexpr int cols = 4;
+
+        template<int R, int C>
+        __attribute__((target("avx2")))
+        static void tile(int k, const std::uint8_t *a, int lda, const std::int8_t *b, int ldb, std::int32_t *c,
+                         int ldc) {
+            __m256i sum[R][C];
+            for (int r = 0; r < R; ++r) {
+                for (int col = 0; col < C; ++col) {
+                    sum[r][col] = _mm256_setzero_si256();
+                }
+            }
+            int p = 0;
+            for (; p + 16 <= k; p += 16) {
+                __m256i av[R];
+                __m256i bv[C];
+                for (int r = 0; r < R; ++r) {
+                    av[r] = _mm256_cvtepu8_epi16(_mm_loadu_si128(reinterpret_cast<const __m128i *>(a + r * lda + p)));
+                }
+                for (int col = 0; col < C; ++col) {
+                    bv[col] = _mm256_cvtepi8_epi16(
+                            _mm_loadu_si128(reinterpret_cast<const __m128i *>(b + col * ldb + p)));
+                }
+                for (int r = 0; r < R; ++r) {
+                    for (int col = 0; col < C; ++col) {
+                        sum[r][col] = _mm256_add_epi32(sum[r][col], _mm256_madd_epi16(av[r], bv[col]));
+                    }
+                }
+            }
+            for (int r = 0; r < R; ++r) {
+                for (int col = 0; col < C; ++col) {
+                    __m128i half = _mm_add_epi32(_mm256_castsi256_si128(sum[r][col]),
+                                                 _mm256_extracti128_si256(sum[r][col], 1));
+                    half = _mm_add_epi32(half, _mm_shuffle_epi32(half, 0x4E));
+                    half = _mm_add_epi32(half, _mm_shuffle_epi32(half, 0xB1));
+                    std::int32_t total = _mm_cvtsi128_si32(half);
+                    for (int q = p; q < k; ++q) {
+                        total += static_cast<std::int32_t>(a[r * lda + q]) * b[col * ldb + q];
+                    }
+                    c[r * ldc + col] = total;
+                }
+            }
+        }
+    };
+
+    // 4x4 tile: 64 bytes of each operand per step multiplied and summed in groups of four by vpdpbusd, 16
+    // accumulators. The k tail is read with masked loads.
+    struct VnniInt8Kernel {
+        static constexpr int rows = 4;
+        static constexpr int cols = 4;
+
+        template<int R, int C>
+        __attribute__((target("avx512f,avx512bw,avx512vnni")))
+        static void tile(int k, const std::uint8_t *a, int lda, const std::int8_t *b, int ldb, std::int32_t *c,
+                         int ldc) {
+            __m512i sum[R][C];
+            for (int r = 0; r < R; ++r) {
+                for (int col = 0; col < C; ++col) {
+                    sum[r][col] = _mm512_setzero_si512();
+                }
+            }
+            for (int p = 0; p < k; p += 64) {
+                const __mmask64 mask = k - p >= 64 ? ~__mmask64(0) : (__mmask64(1) << (k - p)) - 1;
+                __m512i av[R];
+                __m512i bv[C];
+                for (int r = 0; r < R; ++r) {
+                    av[r] = _mm512_maskz_loadu_epi8(mask, a + r * lda + p);
+                }
+                for (int col = 0; col < C; ++col) {
+                    bv[col] = _mm512_maskz_loadu_epi8(mask, b + col * ldb + p);
+                }
+                for (int r = 0; r < R; ++r) {
+                    for (int col = 0; col < C; ++col) {
+                        sum[r][col] = _mm512_dpbusd_epi32(sum[r][col], av[r], bv[col]);
+                    }
+                }
+            }
+            for (int r = 0; r < R; ++r) {
+                for (int col = 0; col < C; ++col) {
+                    // Zero-masked extracts: the unmasked ones and the 512-to-256 cast merge into an undefined
+                    // register, which GCC reports as used uninitialized
+                    const __m256i half = _mm256_add_epi32(_mm512_maskz_extracti64x4_epi64(0xF, sum[r][col], 0),
+                                                          _mm512_maskz_extracti64x4_epi64(0xF, sum[r][col], 1));
+                    __m128i quarter = _mm_add_epi32(_mm256_castsi256_si128(half), _mm256_extracti128_si256(half, 1));
+                    quarter = _mm_add_epi32(quarter, _mm_shuffle_epi32(quarter, 0x4E));
+                    quarter = _mm_add_epi32(quarter, _mm_shuffle_epi32(quarter, 0xB1));
+                    c[r * ldc + col] = _mm_cvtsi128_si32(quarter);
+                }
+            }
+        }
+    };
+#endif
+
+    std::atomic<Compute::Backend> &active() {
+        static std::atomic<Compute::Backend> backend{Compute::bestBackend()};
+        return backend;
+    }
+}
+
+namespace Compute {
+    Backend parseBackend(const std::string &name) {
+        if (name == "eigen") return Backend::Eigen;
+        if (name == "avx2") return Backend::Avx2;
+        if (name == "avx512") return Backend::Avx512;
+        throw std::invalid_argument("Unknown compute backend: " + name);
+    }
+
+    const char *backendName(Backend backend) {
+        switch (backend) {
+            case Backend::Eigen:
+                return "eigen";
+            case Backend::Avx2:
+                return "avx2";
+            case Backend::Avx512:
+                return "avx512";
+        }
+        return "unknown";
+    }
+
+    bool supported(Backend backend) {
+        switch (backend) {
+            case Backend::Eigen:
+                return true;
+#ifdef PERCEPTRON_X86_KERNELS
+            case Backend::Avx2:
+                return __builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma");
+            case Backend::Avx512:
+                return __builtin_cpu_supports("avx512f");
+#endif
+            default:
+                return false;
+        }
+    }
+
+    Backend bestBackend() {
+        for (Backend backend : {Backend::Avx512, Backend::Avx2}) {
+            if (supported(backend)) {
+                return backend;
+            }
+        }
+        return Backend::Eigen;
+    }
+
+    Backend activeBackend() {
+        return active().load(std::memory_order_relaxed);
+    }
+
+    void selectBackend(Backend backend) {
+        if (!supported(backend)) {
+            throw std::runtime_error(std::string("Compute backend not supported on this CPU: ") +
+                                     backendName(backend));
+        }
+        active().store(backend, std::memory_order_relaxed);
+    }
+
+    void gemmU8S8(Backend backend, int m, int n, int k, const std::uint8_t *a, int lda, const std::int8_t *b, int ldb,
+                  std::int32_t *c, int ldc) {
+        switch (backend) {
+#ifdef PERCEPTRON_X86_KERNELS
+            case Backend::Avx512:
+                if (__builtin_cpu_supports("avx512bw") && __builtin_cpu_supports("avx512vnni")) {
+                    int8Gemm<VnniInt8Kernel>(m, n, k, a, lda, b, ldb, c, ldc);
+                    return;
+                }
+                [[fallthrough]];
+            case Backend::Avx2:
+                int8Gemm<Avx2Int8Kernel>(m, n, k, a, lda, b, ldb, c, ldc);
+                return;
+#endif
+            default:
+                int8Gemm<ScalarInt8Kernel>(m, n, k, a, lda, b, ldb, c, ldc);
+        }
+    }
+
+    void sgemm(Backend backend, bool transposeA, bool transposeB, int m, int n, int k, const float *a, int lda,
+               const float *b, int ldb, float *c, int ldc) {
+        switch (backend) {
+#ifdef PERCEPTRON_X86_KERNELS
+            case Backend::Avx2:
+                blockedGemm<Avx2Kernel>(transposeA, transposeB, m, n, k, a, lda, b, ldb, c, ldc);
+                return;
+            case Backend::Avx512:
+                blockedGemm<Avx512Kernel>(transposeA, transposeB, m, n, k, a, lda, b, ldb, c, ldc);
+                return;
+#endif
+            default: {
+                using Map = Eigen::Map<const MatrixT<float>, 0, Eigen::OuterStride<>>;
+                const Map matrixA(a, transposeA ? k : m, transposeA ? m : k, Eigen::OuterStride<>(lda));
+                const Map matrixB(b, transposeB ? n : k, transposeB ? k : n, Eigen::OuterStride<>(ldb));
+                Eigen::Map<MatrixT<float>, 0, Eigen::OuterStride<>> matrixC(c, m, n, Eigen::OuterStride<>(ldc));
+                if (transposeA && transposeB) {
+                    matrixC.noalias() = matrixA.transpose() * matrixB.transpose();
+                } else if (transposeA) {
+                    matrixC.noalias() = matrixA.transpose() * matrixB;
+                } else if (transposeB) {
+                    matrixC.noalias() = matrixA * matrixB.transpose();
+                } else {
+                    matrixC.noalias() = matrixA * matrixB;
+                }
+            }
+        }
+    }
+}
@@ -0,0 +1,80 @@
+#ifndef PERCEPTRON_GEMM_H
+#define PERCEPTRON_GEMM_H
+
+#pragma once
+
+#include <Eigen/Dense>
+#include <cstdint>
+#include <string>
+#include <type_traits>
+#include "../Network/Types.hpp"
+
+// Compute backends for the layer GEMMs. The binary is built for the baseline ISA, so Eigen only uses SSE2; the
+// hand-written AVX2/FMA and AVX-512 micro-kernels are compiled for their ISA individually and the best one the
+// running CPU supports is picked at startup. Only float products go to the SIMD kernels; double always uses Eigen.
+namespace Compute {
+    enum class Backend {
+        Eigen,
+        Avx2,  // 16x6 micro-kernel, AVX2 and FMA
+        Avx512 // 32x12 micro-kernel, AVX-512F
+    };
+
+    // "eigen", "avx2" or "avx512"; throws std::invalid_argument for anything else.
+    Backend parseBackend(const std::string &name);
+
+    const char *backendName(Backend backend);
+
+    // Whether the backend was compiled in and the CPU supports it.
+    bool supported(Backend backend);
+
+    // Fastest supported backend; the default.
+    Backend bestBackend();
+
+    Backend activeBackend();
+
+    // Selects the backend for all later products; throws std::runtime_error if it is not supported.
+    void selectBackend(Backend backend);
+
+    // Backend that computes the layer GEMMs of scalar type T: the active one for float and Eigen for double. Report
+    // this one; the active backend alone says nothing about double-precision training.
+    template<typename T>
+    Backend gemmBackend() {
+        return std::is_same_v<T, float> ? activeBackend() : Backend::Eigen;
+    }
+
+    // Column-major C = op(A) * op(B) with op(A) m x k and op(B) k x n, computed by the given SIMD backend.
+    void sgemm(Backend backend, bool transposeA, bool transposeB, int m, int n, int k, const float *a, int lda,
+               const float *b, int ldb, float *c, int ldc);
+
+    // Row-major c = a * b^T in exact int32 arithmetic, for int8 inference: a is m x k unsigned bytes (row i at
+    // a + i * lda), b is n x k signed bytes (row j at b + j * ldb) and c is m x n (row i at c + i * ldc). Avx2
+    // widens to 16 bits and uses vpmaddwd; Avx512 uses the VNNI vpdpbusd where the CPU has it and the AVX2 kernel
+    // otherwise; Eigen runs a plain loop.
+    void gemmU8S8(Backend backend, int m, int n, int k, const std::uint8_t *a, int lda, const std::int8_t *b, int ldb,
+                  std::int32_t *c, int ldc);
+
+    // c = op(a) * op(b) with the active backend. c must not alias a or b.
+    template<typename T>
+    void multiply(ConstMatrixRef<T> a, bool transposeA, ConstMatrixRef<T> b, bool transposeB, MatrixRef<T> c) {
+        if constexpr (std::is_same_v<T, float>) {
+            const Backend backend = gemmBackend<T>();
+            if (backend != Backend::Eigen) {
+                sgemm(backend, transposeA, transposeB, static_cast<int>(c.rows()), static_cast<int>(c.cols()),
+                      static_cast<int>(transposeA ? a.rows() : a.cols()), a.data(), static_cast<int>(a.outerStride()),
+                      b.data(), static_cast<int>(b.outerStride()), c.data(), static_cast<int>(c.outerStride()));
+                return;
+            }
+        }
+        if (transposeA && transposeB) {
+            c.noalias() = a.transpose() * b.transpose();
+        } else if (transposeA) {
+            c.noalias() = a.transpose() * b;
+        } else if (transposeB) {
+            c.noalias() = a * b.transpose();
+        } else {
+            c.noalias() = a * b;
+        }
+    }
+}
+
+#endif //PERCEPTRON_GEMM_H
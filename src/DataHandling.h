@@ -2,14 +2,94 @@
 #define PERCEPTRON_DATAHANDLING_H
 
 #pragma once
+#include <algorithm>
 #include <string>
 #include <fstream>
 #include <vector>
 #include <stdexcept>
 #include <iostream>
 #include <sstream>
+#include <cstdint>
+#include <cstring>
+#include <limits>
+#include <utility>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include "Metrics/Trace.h"
+#include "Network/Optimizer.h"
+#include "Network/SparseInput.h"
 #include "Network/Types.hpp"
+#include "Random/Rng.h"
 
+// Read-only memory mapping of a whole file. The mapping is released on destruction.
+class MappedFile {
+public:
+    enum class Access {
+        Whole, // The whole file will be read; start reading it ahead right away
+        Random // Only a few records will be touched; disable read-ahead
+    };
+
+    MappedFile() = default;
+
+    explicit MappedFile(const std::string& path, Access access = Access::Whole) {
+        const int fd = ::open(path.c_str(), O_RDONLY);
+        if (fd < 0) {
+            throw std::runtime_error("Cannot open file: " + path);
+        }
+        struct stat st{};
+        if (::fstat(fd, &st) != 0) {
+            ::close(fd);
+            throw std::runtime_error("Cannot stat file: " + path);
+        }
+        size_ = static_cast<std::size_t>(st.st_size);
+        if (size_ > 0) {
+            void* addr = ::mmap(nullptr, size_, PROT_READ, MAP_PRIVATE, fd, 0);
+            if (addr == MAP_FAILED) {
+                ::close(fd);
+                throw std::runtime_error("Cannot map file: " + path);
+            }
+            data_ = static_cast<const unsigned char*>(addr);
+            ::madvise(addr, size_, access == Access::Whole ? MADV_WILLNEED : MADV_RANDOM);
+        }
+        ::close(fd);
+    }
+
+    MappedFile(const MappedFile& other) = delete;
+    MappedFile& operator=(const MappedFile& other) = delete;
+
+    MappedFile(MappedFile&& other) noexcept
+            : data_(std::exchange(other.data_, nullptr)), size_(std::exchange(other.size_, 0)) {}
+
+    MappedFile& operator=(MappedFile&& other) noexcept {
+        if (this != &other) {
+            unmap();
+            data_ = std::exchange(other.data_, nullptr);
+            size_ = std::exchange(other.size_, 0);
+        }
+        return *this;
+    }
+
+    ~MappedFile() { unmap(); }
+
+    [[nodiscard]] const unsigned char* data() const { return data_; }
+    [[nodiscard]] std::size_t size() const { return size_; }
+
+private:
+    const unsigned char* data_ = nullptr;
+    std::size_t size_ = 0;
+
+    void unmap() {
+        if (data_ != nullptr) {
+            ::munmap(const_cast<unsigned char*>(data_), size_);
+            data_ = nullptr;
+            size_ = 0;
+        }
+    }
+};
+
+template<typename T = Precision>
 class MNISTLoader {
 public:
     MNISTLoader() = default;
@@ -22,10 +102,12 @@ public:
     void loadImages(const std::string& path) {
         int magicNumber, count, rows, cols;
         readHeader(path, magicNumber, count, rows, cols, true);
+        validateShape(path, rows, cols);
         images_ = loadMnistImages(path, count, rows, cols);
         image_count_ = count;
         rows_ = rows;
         cols_ = cols;
+        checkRecordCounts(path);
     }
 
     void loadLabels(const std::string& path) {
@@ -33,21 +115,169 @@ public:
         readHeader(path, magicNumber, count, rows, cols, false);
         labels_ = loadMnistLabels(path, count);
         label_count_ = count;
+        checkRecordCounts(path);
+    }
+
+    // Maps the image file instead of expanding it: pixels stay as uint8 inside the mapping
+    // and are only converted to Precision per batch by copyImageBatch. images() stays empty.
+    void mapImages(const std::string& path, MappedFile::Access access = MappedFile::Access::Whole) {
+        TRACE_SCOPE("map_images");
+        MappedFile file(path, access);
+        const int count = validateHeader(file, path, kImageMagic, 16);
+        const int rows = readBigEndian(file.data() + 8);
+        const int cols = readBigEndian(file.data() + 12);
+        validateShape(path, rows, cols);
+        if (file.size() < 16 + static_cast<std::size_t>(count) * static_cast<std::size_t>(rows) * cols) {
+            throw std::runtime_error("Truncated image file: " + path);
+        }
+        image_file_ = std::move(file);
+        image_count_ = count;
+        rows_ = rows;
+        cols_ = cols;
+        checkRecordCounts(path);
+    }
+
+    // Maps the label file; labels are kept as raw class indices and one-hot encoded per batch. Every label is
+    // checked once here, so the batch functions can use them as column indices.
+    void mapLabels(const std::string& path, MappedFile::Access access = MappedFile::Access::Whole) {
+        TRACE_SCOPE("map_labels");
+        MappedFile file(path, access);
+        const int count = validateHeader(file, path, kLabelMagic, 8);
+        if (file.size() < 8 + static_cast<std::size_t>(count)) {
+            throw std::runtime_error("Truncated label file: " + path);
+        }
+        const unsigned char* labels = file.data() + 8;
+        if (std::any_of(labels, labels + count, [](unsigned char label) { return label >= kClasses; })) {
+            throw std::runtime_error("Label out of range 0-9 in: " + path);
+        }
+        label_file_ = std::move(file);
+        label_count_ = count;
+        checkRecordCounts(path);
     }
 
-    [[nodiscard]] const Matrix& images() const { return images_; }
-    [[nodiscard]] const Matrix& labels() const { return labels_; }
+    [[nodiscard]] const MatrixT<T>& images() const { return images_; }
+    [[nodiscard]] const MatrixT<T>& labels() const { return labels_; }
     [[nodiscard]] int imageCount() const { return image_count_; }
     [[nodiscard]] int labelCount() const { return label_count_; }
     [[nodiscard]] int rows() const { return rows_; }
     [[nodiscard]] int cols() const { return cols_; }
+    [[nodiscard]] int imageSize() const { return rows_ * cols_; }
+    [[nodiscard]] bool imagesMapped() const { return image_file_.data() != nullptr; }
+    [[nodiscard]] bool labelsMapped() const { return label_file_.data() != nullptr; }
+
+    // Splits off the last count records as a held-out set: imageCount() and labelCount() no longer include them,
+    // so training never visits them, and they stay readable at [imageCount(), imageCount() + count) through
+    // rawImage, rawLabel and copyImageBatch (requires mapImages and mapLabels).
+    void holdOut(int count) {
+        if (count < 0 || count > image_count_ || image_count_ != label_count_) {
+            throw std::invalid_argument("Cannot hold out " + std::to_string(count) + " records");
+        }
+        image_count_ -= count;
+        label_count_ -= count;
+        held_out_ = count;
+    }
+
+    [[nodiscard]] int heldOutCount() const { return held_out_; }
+
+    // Raw pixels of one image inside the mapping (requires mapImages).
+    [[nodiscard]] const unsigned char* rawImage(int index) const {
+        return image_file_.data() + 16 + static_cast<std::size_t>(index) * static_cast<std::size_t>(imageSize());
+    }
+
+    // Class index of one label inside the mapping (requires mapLabels).
+    [[nodiscard]] int rawLabel(int index) const {
+        return static_cast<int>(label_file_.data()[8 + index]);
+    }
+
+    // Normalizes images [first, first + count) into the leading rows of out.
+    template<typename Derived>
+    void copyImageBatch(int first, int count, Eigen::MatrixBase<Derived>& out) const {
+        using RawImages = Eigen::Matrix<unsigned char, Eigen::Dynamic, Eigen::Dynamic, Eigen::RowMajor>;
+        const Eigen::Map<const RawImages> raw(rawImage(first), count, imageSize());
+        out.topRows(count) = raw.template cast<T>() / static_cast<T>(255.0);
+    }
+
+    // One-hot encodes labels [first, first + count) into the leading rows of out.
+    template<typename Derived>
+    void copyLabelBatch(int first, int count, Eigen::MatrixBase<Derived>& out) const {
+        out.topRows(count).setZero();
+        for (int i = 0; i < count; ++i) {
+            out(i, rawLabel(first + i)) = 1;
+        }
+    }
+
+    // Normalizes the images with the given indices into the leading rows of out.
+    template<typename Derived>
+    void gatherImageBatch(const int* indices, int count, Eigen::MatrixBase<Derived>& out) const {
+        using RawImage = Eigen::Matrix<unsigned char, 1, Eigen::Dynamic>;
+        for (int i = 0; i < count; ++i) {
+            const Eigen::Map<const RawImage> raw(rawImage(indices[i]), imageSize());
+            out.row(i) = raw.template cast<T>() / static_cast<T>(255.0);
+        }
+    }
+
+    // One-hot encodes the labels with the given indices into the leading rows of out.
+    template<typename Derived>
+    void gatherLabelBatch(const int* indices, int count, Eigen::MatrixBase<Derived>& out) const {
+        out.topRows(count).setZero();
+        for (int i = 0; i < count; ++i) {
+            out(i, rawLabel(indices[i])) = 1;
+        }
+    }
 
 private:
-    Matrix images_;
-    Matrix labels_;
+    static constexpr int kImageMagic = 2051;
+    static constexpr int kLabelMagic = 2049;
+    static constexpr int kClasses = 10;
+
+    MatrixT<T> images_;
+    MatrixT<T> labels_;
+    MappedFile image_file_;
+    MappedFile label_file_;
     int image_count_ = 0;
     int label_count_ = 0;
     int rows_ = 0, cols_ = 0;
+    int held_out_ = 0;
+
+    static int readBigEndian(const unsigned char* bytes) {
+        std::uint32_t value;
+        std::memcpy(&value, bytes, 4);
+        return static_cast<int>(__builtin_bswap32(value));
+    }
+
+    static int validateHeader(const MappedFile& file, const std::string& path, int expectedMagic,
+                              std::size_t headerSize) {
+        if (file.size() < headerSize) {
+            throw std::runtime_error("File too small for an IDX header: " + path);
+        }
+        if (readBigEndian(file.data()) != expectedMagic) {
+            throw std::runtime_error("Unexpected IDX magic number in: " + path);
+        }
+        const int count = readBigEndian(file.data() + 4);
+        if (count < 0) {
+            throw std::runtime_error("Invalid IDX record count in: " + path);
+        }
+        return count;
+    }
+
+    // Images must have a positive size that fits imageSize()
+    static void validateShape(const std::string& path, int rows, int cols) {
+        if (rows <= 0 || cols <= 0 ||
+            static_cast<std::size_t>(rows) * static_cast<std::size_t>(cols) >
+            static_cast<std::size_t>(std::numeric_limits<int>::max())) {
+            throw std::runtime_error("Invalid image size in: " + path);
+        }
+    }
+
+    // The image and label files of a loader describe the same records; checked once both are present
+    void checkRecordCounts(const std::string& path) const {
+        const bool haveImages = imagesMapped() || images_.size() > 0;
+        const bool haveLabels = labelsMapped() || labels_.size() > 0;
+        if (haveImages && haveLabels && image_count_ != label_count_) {
+            throw std::runtime_error("Image and label counts differ (" + std::to_string(image_count_) + " vs " +
+                                     std::to_string(label_count_) + ") after loading: " + path);
+        }
+    }
 
     static void readHeader(const std::string &path, int &magicNumber, int &numItems, int &rows, int &cols, bool isImages) {
         std::ifstream file(path, std::ios::binary);
@@ -58,6 +288,9 @@ private:
         file.read(reinterpret_cast<char *>(&numItems), 4);
         magicNumber = static_cast<int>(__builtin_bswap32(magicNumber));
         numItems = static_cast<int>(__builtin_bswap32(numItems));
+        if (!file || numItems < 0) {
+            throw std::runtime_error("Invalid IDX header in: " + path);
+        }
         if (isImages) {
             file.read(reinterpret_cast<char *>(&rows), 4);
             file.read(reinterpret_cast<char *>(&cols), 4);
@@ -69,7 +302,7 @@ private:
         file.close();
     }
 
-    static Matrix loadMnistImages(const std::string &filePath, const int numImages, const int rows, const int cols) {
+    static MatrixT<T> loadMnistImages(const std::string &filePath, const int numImages, const int rows, const int cols) {
         std::ifstream file(filePath, std::ios::binary);
         if (!file.is_open()) {
             throw std::runtime_error("Cannot open file: " + filePath);
@@ -77,12 +310,12 @@ private:
 
         file.seekg(16, std::ios::beg);
 
-        Matrix images(numImages, rows * cols);
+        MatrixT<T> images(numImages, rows * cols);
         for (int i = 0; i < numImages; ++i) {
             std::vector<unsigned char> buffer(rows * cols);
             file.read(reinterpret_cast<char *>(buffer.data()), rows * cols);
             for (int j = 0; j < rows * cols; ++j) {
-                images(i, j) = static_cast<Precision>(buffer[j] / 255.0);
+                images(i, j) = static_cast<T>(buffer[j] / 255.0);
             }
         }
 
@@ -90,7 +323,7 @@ private:
         return images;
     }
 
-    static Matrix loadMnistLabels(const std::string &filePath, const int numLabels) {
+    static MatrixT<T> loadMnistLabels(const std::string &filePath, const int numLabels) {
         std::ifstream file(filePath, std::ios::binary);
         if (!file.is_open()) {
             throw std::runtime_error("Cannot open file: " + filePath);
@@ -98,11 +331,14 @@ private:
 
         file.seekg(8, std::ios::beg);
 
-        Matrix labels = Matrix::Zero(numLabels, 10);
+        MatrixT<T> labels = MatrixT<T>::Zero(numLabels, 10);
         for (int i = 0; i < numLabels; ++i) {
             unsigned char label;
             file.read(reinterpret_cast<char *>(&label), 1);
             int j = static_cast<int>(label);
+            if (j >= kClasses) {
+                throw std::runtime_error("Label out of range 0-9 in: " + filePath);
+            }
             labels(i, j) = 1;
         }
 
@@ -112,6 +348,72 @@ private:
 };
 
 namespace Utils {
+    // Values read from a configuration file. Field names match the config keys.
+    struct Config {
+        int num_epochs = 0;
+        int batch_size = 0;
+        int hidden_size = 0;
+        double learning_rate = 0.0;
+        std::string rel_path_train_images;
+        std::string rel_path_train_labels;
+        std::string rel_path_test_images;
+        std::string rel_path_test_labels;
+        std::string rel_path_log_file;
+        // "double", "float", or "mixed" (float compute with double master weights)
+        std::string precision = "double";
+        // Worker threads for data-parallel training
+        int num_threads = 1;
+        // "sync" (data-parallel with gradient reduction) or "hogwild" (lock-free asynchronous updates)
+        std::string training_mode = "sync";
+        // Visit the training set in a new random order every epoch
+        bool shuffle = true;
+        // Number of batches the background loader prepares ahead of the trainer
+        int prefetch_batches = 4;
+        // Number of test images evaluated per forward pass
+        int eval_batch_size = 1024;
+        // Binary checkpoint written during training (disabled when empty)
+        std::string checkpoint_path;
+        // Epochs between two checkpoints; a checkpoint is always written after the last epoch
+        int checkpoint_interval = 1;
+        // Checkpoint to continue training from, or to evaluate directly when it already covers num_epochs
+        std::string resume_from_checkpoint;
+        // Seed for everything random in a run: weight initialization and the training order
+        std::uint64_t seed = Rng::defaultSeed;
+        // Update rule and its hyperparameters
+        Optimizer::Settings optimizer;
+        // When the first layer uses the sparse input kernels
+        SparseInput::Settings sparse_input;
+        // GEMM backend: "auto" (fastest the CPU supports), "eigen", "avx2" or "avx512". The SIMD kernels are
+        // float-only, so with precision "double" the layers always run on Eigen
+        std::string compute_backend = "auto";
+        // Compute the training loss on every loss_interval-th batch only; the reported error is its mean
+        int loss_interval = 1;
+        // Training metrics file, JSON lines if it ends in .json or .jsonl and CSV otherwise (disabled when empty)
+        std::string metrics_path;
+        // Milliseconds between two metrics lines and progress updates
+        int metrics_interval_ms = 1000;
+        // Worker processes of a distributed sync run, and the index of this one; see mnist_distributed.sh
+        int world_size = 1;
+        int rank = 0;
+        // Address of every rank, or one address for all ranks
+        std::vector<std::string> ring_hosts{"127.0.0.1"};
+        // Rank r listens on ring_port + r
+        int ring_port = 29500;
+        // Fraction of the training set held out for validation after every epoch (disabled when 0)
+        double validation_split = 0.0;
+        // Stop after this many epochs without a better validation accuracy (disabled when 0)
+        int early_stopping_patience = 0;
+        // Also classify the test set with the int8-quantized network and report the accuracy difference
+        bool quantized_inference = false;
+        // "off", "on" (measure batch_size, num_threads, compute_backend and sparse_input once per machine and reuse
+        // the cached result) or "refresh" (measure again and replace the cached result)
+        std::string autotune = "off";
+        // Text file holding the tuned settings of every machine, precision and layer shape
+        std::string autotune_cache = "autotune_cache.txt";
+        // Chrome trace-event JSON file of the run's timeline; needs a build with -DPERCEPTRON_TRACE=ON
+        std::string trace_path;
+    };
+
     inline void writeTensorToFile(const Matrix& tensor, const std::string& filename) {
         std::ofstream file(filename);
         if(!file) {
@@ -136,24 +438,10 @@ namespace Utils {
         file.close();
     }
 
-    inline bool parseConfigFile(const std::string& filename,
-                                int & num_epochs,
-                                int & batch_size,
-                                int & hidden_size ,
-                                double & learning_rate,
-                                std::string & rel_path_train_images,
-                                std::string & rel_path_train_labels ,
-                                std::string & rel_path_test_images,
-                                std::string & rel_path_test_labels,
-                                std::string & rel_path_log_file ) {
-        std::ifstream file(filename);
-        if (!file.is_open()) {
-            std::cerr << "Error opening file: " << filename << std::endl;
-            return false;
-        }
-
+    // Parses "key = value" lines into config; lines that are empty or start with '#' are skipped.
+    inline bool parseConfig(std::istream& input, Config& config) {
         std::string line;
-        while (std::getline(file, line)) {
+        while (std::getline(input, line)) {
             if (line.empty() || line[0] == '#') {
                 continue;
             }
@@ -168,30 +456,239 @@ namespace Utils {
                 value.erase(value.find_last_not_of(" \t") + 1);
 
                 if (key == "num_epochs") {
-                    num_epochs = std::stoi(value);
+                    config.num_epochs = std::stoi(value);
                 } else if (key == "batch_size") {
-                    batch_size = std::stoi(value);
+                    config.batch_size = std::stoi(value);
                 } else if (key == "hidden_size") {
-                    hidden_size = std::stoi(value);
+                    config.hidden_size = std::stoi(value);
                 } else if (key == "learning_rate") {
-                    learning_rate = std::stod(value);
+                    config.learning_rate = std::stod(value);
                 } else if (key == "rel_path_train_images") {
-                    rel_path_train_images = value;
+                    config.rel_path_train_images = value;
                 } else if (key == "rel_path_train_labels") {
-                    rel_path_train_labels = value;
+                    config.rel_path_train_labels = value;
                 } else if (key == "rel_path_test_images") {
-                    rel_path_test_images = value;
+                    config.rel_path_test_images = value;
                 } else if (key == "rel_path_test_labels") {
-                    rel_path_test_labels = value;
+                    config.rel_path_test_labels = value;
                 } else if (key == "rel_path_log_file") {
-                    rel_path_log_file = value;
+                    config.rel_path_log_file = value;
+                } else if (key == "precision") {
+                    if (value != "double" && value != "float" && value != "mixed") {
+                        std::cerr << "Invalid precision: " << value << " (expected double, float or mixed)" << std::endl;
+                        return false;
+                    }
+                    config.precision = value;
+                } else if (key == "num_threads") {
+                    config.num_threads = std::stoi(value);
+                    if (config.num_threads < 1) {
+                        std::cerr << "Invalid num_threads: " << value << std::endl;
+                        return false;
+                    }
+                } else if (key == "training_mode") {
+                    if (value != "sync" && value != "hogwild") {
+                        std::cerr << "Invalid training_mode: " << value << " (expected sync or hogwild)" << std::endl;
+                        return false;
+                    }
+                    config.training_mode = value;
+                } else if (key == "shuffle") {
+                    if (value != "true" && value != "false") {
+                        std::cerr << "Invalid shuffle: " << value << " (expected true or false)" << std::endl;
+                        return false;
+                    }
+                    config.shuffle = value == "true";
+                } else if (key == "prefetch_batches") {
+                    config.prefetch_batches = std::stoi(value);
+                    if (config.prefetch_batches < 1) {
+                        std::cerr << "Invalid prefetch_batches: " << value << std::endl;
+                        return false;
+                    }
+                } else if (key == "eval_batch_size") {
+                    config.eval_batch_size = std::stoi(value);
+                    if (config.eval_batch_size < 1) {
+                        std::cerr << "Invalid eval_batch_size: " << value << std::endl;
+                        return false;
+                    }
+                } else if (key == "checkpoint_path") {
+                    config.checkpoint_path = value;
+                } else if (key == "checkpoint_interval") {
+                    config.checkpoint_interval = std::stoi(value);
+                    if (config.checkpoint_interval < 1) {
+                        std::cerr << "Invalid checkpoint_interval: " << value << std::endl;
+                        return false;
+                    }
+                } else if (key == "resume_from_checkpoint") {
+                    config.resume_from_checkpoint = value;
+                } else if (key == "seed") {
+                    config.seed = std::stoull(value);
+                } else if (key == "optimizer") {
+                    try {
+                        config.optimizer.kind = Optimizer::parseKind(value);
+                    } catch (const std::invalid_argument &) {
+                        std::cerr << "Invalid optimizer: " << value
+                                  << " (expected sgd, momentum, nesterov, adam or adamw)" << std::endl;
+                        return false;
+                    }
+                } else if (key == "momentum") {
+                    config.optimizer.momentum = std::stod(value);
+                } else if (key == "beta1") {
+                    config.optimizer.beta1 = std::stod(value);
+                } else if (key == "beta2") {
+                    config.optimizer.beta2 = std::stod(value);
+                } else if (key == "epsilon") {
+                    config.optimizer.epsilon = std::stod(value);
+                } else if (key == "weight_decay") {
+                    config.optimizer.weightDecay = std::stod(value);
+                } else if (key == "sparse_input") {
+                    try {
+                        config.sparse_input.mode = SparseInput::parseMode(value);
+                    } catch (const std::invalid_argument &) {
+                        std::cerr << "Invalid sparse_input: " << value << " (expected off, auto or on)" << std::endl;
+                        return false;
+                    }
+                } else if (key == "sparse_input_threshold") {
+                    config.sparse_input.threshold = std::stod(value);
+                    if (config.sparse_input.threshold < 0 || config.sparse_input.threshold > 1) {
+                        std::cerr << "Invalid sparse_input_threshold: " << value << " (expected 0 to 1)" << std::endl;
+                        return false;
+                    }
+                } else if (key == "compute_backend") {
+                    if (value != "auto" && value != "eigen" && value != "avx2" && value != "avx512") {
+                        std::cerr << "Invalid compute_backend: " << value << " (expected auto, eigen, avx2 or avx512)"
+                                  << std::endl;
+                        return false;
+                    }
+                    config.compute_backend = value;
+                } else if (key == "loss_interval") {
+                    config.loss_interval = std::stoi(value);
+                    if (config.loss_interval < 1) {
+                        std::cerr << "Invalid loss_interval: " << value << std::endl;
+                        return false;
+                    }
+                } else if (key == "metrics_path") {
+                    config.metrics_path = value;
+                } else if (key == "metrics_interval_ms") {
+                    config.metrics_interval_ms = std::stoi(value);
+                    if (config.metrics_interval_ms < 1) {
+                        std::cerr << "Invalid metrics_interval_ms: " << value << std::endl;
+                        return false;
+                    }
+                } else if (key == "world_size") {
+                    config.world_size = std::stoi(value);
+                    if (config.world_size < 1) {
+                        std::cerr << "Invalid world_size: " << value << std::endl;
+                        return false;
+                    }
+                } else if (key == "rank") {
+                    config.rank = std::stoi(value);
+                } else if (key == "ring_hosts") {
+                    config.ring_hosts.clear();
+                    std::istringstream hosts(value);
+                    std::string host;
+                    while (std::getline(hosts, host, ',')) {
+                        host.erase(0, host.find_first_not_of(" \t"));
+                        host.erase(host.find_last_not_of(" \t") + 1);
+                        if (!host.empty()) {
+                            config.ring_hosts.push_back(host);
+                        }
+                    }
+                } else if (key == "ring_port") {
+                    config.ring_port = std::stoi(value);
+                    if (config.ring_port < 1 || config.ring_port > 65535) {
+                        std::cerr << "Invalid ring_port: " << value << std::endl;
+                        return false;
+                    }
+                } else if (key == "validation_split") {
+                    config.validation_split = std::stod(value);
+                    if (config.validation_split < 0 || config.validation_split >= 1) {
+                        std::cerr << "Invalid validation_split: " << value << " (expected 0 to below 1)" << std::endl;
+                        return false;
+                    }
+                } else if (key == "early_stopping_patience") {
+                    config.early_stopping_patience = std::stoi(value);
+                    if (config.early_stopping_patience < 0) {
+                        std::cerr << "Invalid early_stopping_patience: " << value << std::endl;
+                        return false;
+                    }
+                } else if (key == "quantized_inference") {
+                    if (value != "true" && value != "false") {
+                        std::cerr << "Invalid quantized_inference: " << value << " (expected true or false)"
+                                  << std::endl;
+                        return false;
+                    }
+                    config.quantized_inference = value == "true";
+                } else if (key == "autotune") {
+                    if (value != "off" && value != "on" && value != "refresh") {
+                        std::cerr << "Invalid autotune: " << value << " (expected off, on or refresh)" << std::endl;
+                        return false;
+                    }
+                    config.autotune = value;
+                } else if (key == "autotune_cache") {
+                    config.autotune_cache = value;
+                } else if (key == "trace_path") {
+                    config.trace_path = value;
                 } else {
                     std::cerr << "Unknown key: " << key << std::endl;
                 }
             }
         }
 
-        file.close();
+        if (config.rank < 0 || config.rank >= config.world_size) {
+            std::cerr << "Invalid rank: " << config.rank << " (expected 0 to world_size - 1)" << std::endl;
+            return false;
+        }
+        if (config.world_size > 1 && config.training_mode == "hogwild") {
+            std::cerr << "training_mode hogwild does not support world_size > 1" << std::endl;
+            return false;
+        }
+        // Tuning measures synchronous steps of this process; all ranks of a distributed run must agree on the batch
+        if (config.autotune != "off" && (config.training_mode != "sync" || config.world_size > 1)) {
+            std::cerr << "autotune requires training_mode sync and world_size 1" << std::endl;
+            return false;
+        }
+        if (config.early_stopping_patience > 0 && config.validation_split == 0) {
+            std::cerr << "early_stopping_patience requires validation_split" << std::endl;
+            return false;
+        }
+        if (config.ring_hosts.size() > 1 && static_cast<int>(config.ring_hosts.size()) != config.world_size) {
+            std::cerr << "Invalid ring_hosts: expected one address or world_size addresses" << std::endl;
+            return false;
+        }
+        return true;
+    }
+
+    inline bool parseConfigFile(const std::string& filename, Config& config) {
+        std::ifstream file(filename);
+        if (!file.is_open()) {
+            std::cerr << "Error opening file: " << filename << std::endl;
+            return false;
+        }
+        return parseConfig(file, config);
+    }
+
+    inline bool parseConfigFile(const std::string& filename,
+                                int & num_epochs,
+                                int & batch_size,
+                                int & hidden_size ,
+                                double & learning_rate,
+                                std::string & rel_path_train_images,
+                                std::string & rel_path_train_labels ,
+                                std::string & rel_path_test_images,
+                                std::string & rel_path_test_labels,
+                                std::string & rel_path_log_file ) {
+        Config config;
+        if (!parseConfigFile(filename, config)) {
+            return false;
+        }
+        num_epochs = config.num_epochs;
+        batch_size = config.batch_size;
+        hidden_size = config.hidden_size;
+        learning_rate = config.learning_rate;
+        rel_path_train_images = config.rel_path_train_images;
+        rel_path_train_labels = config.rel_path_train_labels;
+        rel_path_test_images = config.rel_path_test_images;
+        rel_path_test_labels = config.rel_path_test_labels;
+        rel_path_log_file = config.rel_path_log_file;
         return true;
     }
 } // namespace Utils
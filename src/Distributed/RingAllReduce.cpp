@@ -0,0 +1,197 @@
+#include "RingAllReduce.h"
+
+#include <cerrno>
+#include <chrono>
+#include <cstdint>
+#include <cstring>
+#include <stdexcept>
+#include <thread>
+#include <arpa/inet.h>
+#include <fcntl.h>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+namespace {
+    constexpr auto connectTimeout = std::chrono::seconds(60);
+
+    [[noreturn]] void fail(const std::string &message, int error = errno) {
+        throw std::runtime_error(message + ": " + std::strerror(error));
+    }
+
+    [[noreturn]] void timeout(const std::string &message) {
+        throw std::runtime_error(message + ": timeout");
+    }
+
+    void configure(int fd) {
+        const int enable = 1;
+        ::setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &enable, sizeof(enable));
+        ::fcntl(fd, F_SETFL, ::fcntl(fd, F_GETFL) | O_NONBLOCK);
+    }
+
+    // Blocking transfer of a small handshake message on a non-blocking socket.
+    void transfer(int fd, void *data, std::size_t bytes, bool send) {
+        auto *position = static_cast<unsigned char *>(data);
+        while (bytes > 0) {
+            pollfd descriptor{fd, static_cast<short>(send ? POLLOUT : POLLIN), 0};
+            ::poll(&descriptor, 1, -1);
+            const ssize_t done = send ? ::send(fd, position, bytes, MSG_NOSIGNAL) : ::recv(fd, position, bytes, 0);
+            if (done == 0 || (done < 0 && errno != EAGAIN && errno != EINTR)) {
+                fail("Ring handshake failed");
+            }
+            if (done > 0) {
+                position += done;
+                bytes -= static_cast<std::size_t>(done);
+            }
+        }
+    }
+}
+
+RingAllReduce::RingAllReduce(int rank, int worldSize, const std::vector<std::string> &hosts, int basePort)
+        : rank_(rank), worldSize_(worldSize) {
+    if (worldSize < 1 || rank < 0 || rank >= worldSize) {
+        throw std::invalid_argument("Invalid rank " + std::to_string(rank) + " of " + std::to_string(worldSize));
+    }
+    if (worldSize == 1) {
+        return;
+    }
+    auto host = [&](int r) { return hosts.empty() ? std::string("127.0.0.1") : hosts[hosts.size() == 1 ? 0 : r]; };
+    if (hosts.size() > 1 && static_cast<int>(hosts.size()) != worldSize) {
+        throw std::invalid_argument("Expected one ring host per rank");
+    }
+
+    addrinfo hints{};
+    hints.ai_family = AF_INET;
+    hints.ai_socktype = SOCK_STREAM;
+    addrinfo *resolved = nullptr;
+
+    // Listen first so the previous rank can connect while this one is still connecting to the next. The ring
+    // carries unauthenticated gradients, so the listener only binds the address configured for this rank
+    // (loopback by default) instead of every interface.
+    const std::string listenPort = std::to_string(basePort + rank);
+    if (::getaddrinfo(host(rank).c_str(), listenPort.c_str(), &hints, &resolved) != 0 || resolved == nullptr) {
+        throw std::runtime_error("Cannot resolve ring host " + host(rank));
+    }
+    const int listener = ::socket(AF_INET, SOCK_STREAM, 0);
+    const int enable = 1;
+    ::setsockopt(listener, SOL_SOCKET, SO_REUSEADDR, &enable, sizeof(enable));
+    const bool listening = listener >= 0 && ::bind(listener, resolved->ai_addr, resolved->ai_addrlen) == 0 &&
+                           ::listen(listener, 1) == 0;
+    ::freeaddrinfo(resolved);
+    resolved = nullptr;
+    if (!listening) {
+        const int error = errno;
+        if (listener >= 0) {
+            ::close(listener);
+        }
+        fail("Cannot listen on " + host(rank) + ":" + listenPort, error);
+    }
+
+    // Connect to the next rank, retrying until it is up
+    const int nextRank = (rank + 1) % worldSize;
+    const std::string port = std::to_string(basePort + nextRank);
+    if (::getaddrinfo(host(nextRank).c_str(), port.c_str(), &hints, &resolved) != 0 || resolved == nullptr) {
+        ::close(listener);
+        throw std::runtime_error("Cannot resolve ring host " + host(nextRank));
+    }
+    const auto deadline = std::chrono::steady_clock::now() + connectTimeout;
+    while (true) {
+        next = ::socket(AF_INET, SOCK_STREAM, 0);
+        if (::connect(next, resolved->ai_addr, resolved->ai_addrlen) == 0) {
+            break;
+        }
+        ::close(next);
+        next = -1;
+        if (std::chrono::steady_clock::now() > deadline) {
+            ::freeaddrinfo(resolved);
+            ::close(listener);
+            fail("Cannot connect to rank " + std::to_string(nextRank) + " at " + host(nextRank) + ":" + port);
+        }
+        std::this_thread::sleep_for(std::chrono::milliseconds(50));
+    }
+    ::freeaddrinfo(resolved);
+    configure(next);
+
+    pollfd pending{listener, POLLIN, 0};
+    const int ready = ::poll(&pending, 1, static_cast<int>(std::chrono::milliseconds(connectTimeout).count()));
+    if (ready != 1) {
+        const int error = errno;
+        ::close(listener);
+        const std::string message = "Rank " + std::to_string((rank + worldSize - 1) % worldSize) + " did not connect";
+        if (ready == 0) {
+            timeout(message);
+        }
+        fail(message, error);
+    }
+    previous = ::accept(listener, nullptr, nullptr);
+    ::close(listener);
+    if (previous < 0) {
+        fail("Cannot accept the previous rank");
+    }
+    configure(previous);
+
+    // Both ends announce their rank and world size so misconfigured launches fail early
+    std::int32_t announced[2] = {rank, worldSize};
+    std::int32_t expected[2];
+    transfer(next, announced, sizeof(announced), true);
+    transfer(previous, expected, sizeof(expected), false);
+    if (expected[0] != (rank + worldSize - 1) % worldSize || expected[1] != worldSize) {
+        throw std::runtime_error("Ring neighbour reports rank " + std::to_string(expected[0]) + " of " +
+                                 std::to_string(expected[1]));
+    }
+}
+
+RingAllReduce::~RingAllReduce() {
+    if (next >= 0) {
+        ::close(next);
+    }
+    if (previous >= 0) {
+        ::close(previous);
+    }
+}
+
+void RingAllReduce::barrier() {
+    unsigned char token = 0;
+    unsigned char received = 0;
+    for (int step = 0; step < worldSize_ - 1; ++step) {
+        exchange(&token, 1, &received, 1);
+    }
+}
+
+void RingAllReduce::exchange(const void *send, std::size_t sendBytes, void *receive, std::size_t receiveBytes) {
+    const auto *sendPosition = static_cast<const unsigned char *>(send);
+    auto *receivePosition = static_cast<unsigned char *>(receive);
+    while (sendBytes > 0 || receiveBytes > 0) {
+        pollfd descriptors[2] = {{next, static_cast<short>(sendBytes > 0 ? POLLOUT : 0), 0},
+                                 {previous, static_cast<short>(receiveBytes > 0 ? POLLIN : 0), 0}};
+        if (::poll(descriptors, 2, -1) < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            fail("Ring poll failed");
+        }
+        if (sendBytes > 0 && (descriptors[0].revents & (POLLOUT | POLLERR | POLLHUP))) {
+            const ssize_t sent = ::send(next, sendPosition, sendBytes, MSG_NOSIGNAL);
+            if (sent < 0 && errno != EAGAIN && errno != EINTR) {
+                fail("Lost connection to rank " + std::to_string((rank_ + 1) % worldSize_));
+            }
+            if (sent > 0) {
+                sendPosition += sent;
+                sendBytes -= static_cast<std::size_t>(sent);
+            }
+        }
+        if (receiveBytes > 0 && (descriptors[1].revents & (POLLIN | POLLERR | POLLHUP))) {
+            const ssize_t got = ::recv(previous, receivePosition, receiveBytes, 0);
+            if (got == 0 || (got < 0 && errno != EAGAIN && errno != EINTR)) {
+                fail("Lost connection to rank " + std::to_string((rank_ + worldSize_ - 1) % worldSize_));
+            }
+            if (got > 0) {
+                receivePosition += got;
+                receiveBytes -= static_cast<std::size_t>(got);
+            }
+        }
+    }
+}
@@ -0,0 +1,78 @@
+#ifndef PERCEPTRON_RINGALLREDUCE_H
+#define PERCEPTRON_RINGALLREDUCE_H
+
+#pragma once
+
+#include <algorithm>
+#include <cstddef>
+#include <string>
+#include <vector>
+
+// Sums buffers across the worker processes of a training run with the bandwidth-optimal ring algorithm. The ranks
+// form a ring of TCP connections (rank r listens on basePort + r and connects to rank r + 1); a reduction sends
+// every element 2 (N - 1) / N times: N - 1 reduce-scatter steps leave each rank with one fully reduced chunk, and
+// N - 1 all-gather steps hand the reduced chunks around. Every chunk is reduced in the same order on every call
+// and the final bytes are copied, not recomputed, so all ranks end up with bit-identical results. Chunk c is summed
+// sequentially in ring order starting at rank c, which differs from a pairwise tree for N > 2, so the rounding of
+// N processes can differ from that of one process summing N partial results as a tree.
+class RingAllReduce {
+public:
+    // hosts holds one address per rank, or a single address used for all ranks. Blocks until both ring
+    // neighbours are connected.
+    RingAllReduce(int rank, int worldSize, const std::vector<std::string> &hosts, int basePort);
+
+    ~RingAllReduce();
+
+    RingAllReduce(const RingAllReduce &other) = delete;
+    RingAllReduce &operator=(const RingAllReduce &other) = delete;
+
+    [[nodiscard]] int rank() const { return rank_; }
+    [[nodiscard]] int worldSize() const { return worldSize_; }
+
+    // Replaces data[0, count) on every rank by its sum over all ranks.
+    template<typename T>
+    void allReduce(T *data, std::size_t count) {
+        if (worldSize_ == 1) {
+            return;
+        }
+        const int n = worldSize_;
+        auto chunkBegin = [&](int chunk) { return count * static_cast<std::size_t>(chunk) / n; };
+        auto chunkSize = [&](int chunk) { return chunkBegin(chunk + 1) - chunkBegin(chunk); };
+        scratch.resize(std::max(scratch.size(), (count / n + 1) * sizeof(T)));
+        T *received = reinterpret_cast<T *>(scratch.data());
+
+        // Reduce-scatter: in step s, send chunk (rank - s) and add the incoming chunk (rank - s - 1)
+        for (int step = 0; step < n - 1; ++step) {
+            const int sendChunk = ((rank_ - step) % n + n) % n;
+            const int receiveChunk = ((rank_ - step - 1) % n + n) % n;
+            exchange(data + chunkBegin(sendChunk), chunkSize(sendChunk) * sizeof(T), received,
+                     chunkSize(receiveChunk) * sizeof(T));
+            T *target = data + chunkBegin(receiveChunk);
+            for (std::size_t i = 0; i < chunkSize(receiveChunk); ++i) {
+                target[i] += received[i];
+            }
+        }
+        // All-gather: rank now owns the reduced chunk (rank + 1); pass the reduced chunks around the ring
+        for (int step = 0; step < n - 1; ++step) {
+            const int sendChunk = ((rank_ + 1 - step) % n + n) % n;
+            const int receiveChunk = ((rank_ - step) % n + n) % n;
+            exchange(data + chunkBegin(sendChunk), chunkSize(sendChunk) * sizeof(T), data + chunkBegin(receiveChunk),
+                     chunkSize(receiveChunk) * sizeof(T));
+        }
+    }
+
+    // Blocks until every rank has called barrier().
+    void barrier();
+
+private:
+    int rank_;
+    int worldSize_;
+    int next = -1;     // Connection to rank + 1
+    int previous = -1; // Connection from rank - 1
+    std::vector<unsigned char> scratch;
+
+    // Sends sendBytes to the next rank while receiving receiveBytes from the previous one.
+    void exchange(const void *send, std::size_t sendBytes, void *receive, std::size_t receiveBytes);
+};
+
+#endif //PERCEPTRON_RINGALLREDUCE_H
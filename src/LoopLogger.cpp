@@ -1,55 +1,147 @@
 #include "LoopLogger.h"
 
+#include "Metrics/Trace.h"
+
 // Constructor
-LoopLogger::LoopLogger(int maxIterations)
-        : maxIterations(maxIterations), running(true), currentIteration(0), lastIteration(0) {
+LoopLogger::LoopLogger(int maxIterations, const Metrics::TrainingMetrics &metrics, Options options)
+        : metrics(metrics), options(std::move(options)), currentIteration(this->options.firstIteration),
+          maxIterations(maxIterations) {
+    if (!this->options.metricsPath.empty()) {
+        const std::string &path = this->options.metricsPath;
+        json = path.ends_with(".json") || path.ends_with(".jsonl");
+        metricsFile.open(path);
+        if (!metricsFile) {
+            throw std::runtime_error("Cannot create metrics file: " + path);
+        }
+        if (!json) {
+            metricsFile << "time_s,epoch,error,samples,batches,samples_per_s,gflops,allocations";
+            for (const char *phase : Metrics::phaseNames) {
+                metricsFile << ',' << phase << "_s";
+            }
+            metricsFile << '\n';
+        }
+    }
     startTime = std::chrono::steady_clock::now(); // Initialize start time
     logThread = std::thread(&LoopLogger::log, this);  // Start logging thread
 }
 
 // Destructor
 LoopLogger::~LoopLogger() {
-    running = false; // Stop the logging
-    if (logThread.joinable()) {
-        logThread.join(); // Wait for the logging thread to finish
-    }
+    waitForCompletion();
 }
 
 // Update function for progress
 void LoopLogger::updateProgress(int iteration, double error) {
-    currentIteration.store(iteration); // Update current iteration
-    currentError.store(error); // Update current error
+    {
+        std::lock_guard lock(mutex);
+        currentIteration = iteration;
+        currentError = error;
+        updated = true;
+    }
+    wakeup.notify_one();
+}
+
+void LoopLogger::updateValidation(double accuracy) {
+    std::lock_guard lock(mutex);
+    validationAccuracy = accuracy;
 }
 
 // Logging function that runs in a separate thread
 void LoopLogger::log() {
-    while (running) {
-        std::this_thread::sleep_for(std::chrono::seconds(1)); // Sleep for a while
-        if(lastIteration == currentIteration.load()) continue;
-        auto now = std::chrono::steady_clock::now(); // Get current time
-        std::chrono::duration<double> elapsedTime = now - startTime; // Calculate elapsed time
+    TRACE_THREAD_NAME("LoopLogger");
+    std::unique_lock lock(mutex);
+    while (true) {
+        wakeup.wait_for(lock, options.interval, [this] { return !running || updated; });
+        const bool stopping = !running;
+        updated = false;
+        const int iteration = currentIteration;
+        const double error = currentError;
+        const double validation = validationAccuracy;
+        lock.unlock();
 
-        // Calculate progress and estimated times
-        double progress = static_cast<double>(currentIteration) / maxIterations;
-        int remainingIterations = maxIterations - currentIteration;
-        double estimatedTotalTime = elapsedTime.count() / progress;
-        double remainingTime = estimatedTotalTime - elapsedTime.count();
+        const double elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - startTime).count();
+        const Metrics::Snapshot snapshot = metrics.snapshot();
+        // The final wakeup usually follows the report of the last iteration; skip it if nothing happened since
+        if (!stopping || snapshot.samples != last.samples || iteration != lastIteration) {
+            TRACE_SCOPE("report");
+            report(snapshot, elapsed, iteration, error, validation);
+        }
 
-        // Print formatted log output
-        std::cout << "\rProgress: "
-                  << currentIteration << "/" << maxIterations << " ("
-                  << std::fixed << std::setprecision(2) << (progress * 100) << "%) "
-                  << "Error: " << std::fixed << std::setprecision(6) << currentError.load() << " "
-                  << "Time Elapsed: " << formatDuration(elapsedTime.count()) << ", "
-                  << "Estimated Remaining Time: " << formatDuration(remainingTime) << std::flush;
-        if (currentIteration == maxIterations) {
-            running = false; // Stop logging if all iterations are completed
+        lock.lock();
+        if (stopping) {
+            break;
         }
-        lastIteration = currentIteration.load();
     }
     std::cout << "\nLogging stopped.\n"; // Indicate logging stop
 }
 
+void LoopLogger::report(const Metrics::Snapshot &snapshot, double elapsed, int iteration, double error,
+                        double validation) {
+    const double interval = elapsed - lastElapsed;
+    const double samplesPerSecond = interval > 0 ? static_cast<double>(snapshot.samples - last.samples) / interval : 0;
+    const double gflops = interval > 0 ? static_cast<double>(snapshot.flops - last.flops) / interval * 1e-9 : 0;
+
+    if (metricsFile) {
+        auto field = [&](const char *name, const auto &value) {
+            if (json) {
+                metricsFile << '"' << name << "\":";
+            }
+            metricsFile << value;
+        };
+        metricsFile << (json ? "{" : "");
+        field("time_s", elapsed);
+        metricsFile << ',';
+        field("epoch", iteration);
+        metricsFile << ',';
+        field("error", error);
+        metricsFile << ',';
+        field("samples", snapshot.samples);
+        metricsFile << ',';
+        field("batches", snapshot.batches);
+        metricsFile << ',';
+        field("samples_per_s", samplesPerSecond);
+        metricsFile << ',';
+        field("gflops", gflops);
+        metricsFile << ',';
+        field("allocations", snapshot.allocations);
+        for (std::size_t p = 0; p < snapshot.phaseNanoseconds.size(); ++p) {
+            metricsFile << ',';
+            const std::string name = std::string(Metrics::phaseNames[p]) + "_s";
+            field(name.c_str(), static_cast<double>(snapshot.phaseNanoseconds[p]) * 1e-9);
+        }
+        metricsFile << (json ? "}\n" : "\n") << std::flush;
+    }
+
+    // Progress counts the samples of this run, so it also advances within an iteration
+    const long long totalSamples = options.samplesPerIteration * (maxIterations - options.firstIteration);
+    const double progress = totalSamples > 0
+                            ? std::min(1.0, static_cast<double>(snapshot.samples) / static_cast<double>(totalSamples))
+                            : static_cast<double>(iteration) / maxIterations;
+    const double remainingTime = progress > 0 ? elapsed / progress - elapsed : 0;
+    constexpr int barWidth = 20;
+    const int filled = static_cast<int>(progress * barWidth);
+
+    // Print formatted log output
+    const std::streamsize precision = std::cout.precision();
+    const std::ios_base::fmtflags flags = std::cout.flags();
+    std::cout << "\r[" << std::string(filled, '#') << std::string(barWidth - filled, '.') << "] "
+              << "Progress: " << iteration << "/" << maxIterations << " ("
+              << std::fixed << std::setprecision(2) << (progress * 100) << "%) "
+              << "Error: " << std::fixed << std::setprecision(6) << error << " ";
+    if (validation >= 0) {
+        std::cout << "Validation: " << std::setprecision(2) << validation * 100 << "% ";
+    }
+    std::cout << std::setprecision(0) << samplesPerSecond << " samples/s "
+              << "Time Elapsed: " << formatDuration(elapsed) << ", "
+              << "Estimated Remaining Time: " << formatDuration(remainingTime) << std::flush;
+    std::cout.precision(precision);
+    std::cout.flags(flags);
+
+    last = snapshot;
+    lastElapsed = elapsed;
+    lastIteration = iteration;
+}
+
 // Function to format duration into a readable string
 std::string LoopLogger::formatDuration(double seconds) {
     int hours = static_cast<int>(seconds) / 3600;
@@ -60,7 +152,12 @@ std::string LoopLogger::formatDuration(double seconds) {
 }
 
 void LoopLogger::waitForCompletion() {
+    {
+        std::lock_guard lock(mutex);
+        running = false;
+    }
+    wakeup.notify_one();
     if (logThread.joinable()) {
         logThread.join(); // Wait for the logging thread to finish
     }
-}
\ No newline at end of file
+}
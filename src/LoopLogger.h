@@ -10,13 +10,27 @@
 #include <thread>
 #include <atomic>
 #include <chrono>
+#include <condition_variable>
+#include <fstream>
 #include <iomanip>
+#include <mutex>
 #include <string>
+#include "Metrics/TrainingMetrics.h"
 
+// Reports training progress from a background thread. The thread wakes up every interval, and immediately when an
+// iteration finishes or the logger stops, reads a snapshot of the training metrics, appends one line with the
+// rates of the last interval to the metrics file (JSON lines if the path ends in .json or .jsonl, CSV otherwise)
+// and redraws the console progress bar.
 class LoopLogger {
 public:
-    // Constructor that takes the maximum number of iterations
-    LoopLogger(int maxIterations);
+    struct Options {
+        int firstIteration = 0;                  // Iterations completed before this run, e.g. when resuming
+        long long samplesPerIteration = 0;       // Used for progress within an iteration
+        std::string metricsPath;                 // Metrics file; none if empty
+        std::chrono::milliseconds interval{1000};
+    };
+
+    LoopLogger(int maxIterations, const Metrics::TrainingMetrics &metrics, Options options);
 
     // Destructor to clean up thread
     ~LoopLogger();
@@ -24,22 +38,39 @@ public:
     // Method to update progress with the current iteration
     void updateProgress(int iteration, double error);
 
+    // Shows the latest validation accuracy on the progress bar from the next redraw on
+    void updateValidation(double accuracy);
+
+    // Writes the final report and stops the logging thread without waiting for the next interval.
     void waitForCompletion();
 
 private:
     // Logging method that runs in a separate thread
     void log();
 
+    // Writes one metrics line and redraws the progress bar
+    void report(const Metrics::Snapshot &snapshot, double elapsed, int iteration, double error, double validation);
+
     // Method to format the elapsed time
     std::string formatDuration(double seconds);
 
     // Member variables
+    const Metrics::TrainingMetrics &metrics;
+    Options options;
+    std::ofstream metricsFile;
+    bool json = false;
     std::thread logThread;                        // Thread for logging
-    std::atomic<bool> running;                    // Control flag for running status
-    int lastIteration;                            // Last completed iteration
-    std::atomic<int> currentIteration;            // Current iteration count
-    std::atomic<double> currentError;             // Current error value>
+    std::mutex mutex;                             // Guards the members below
+    std::condition_variable wakeup;
+    bool running = true;                          // Control flag for running status
+    bool updated = false;                         // An iteration finished since the last report
+    int currentIteration;                         // Last completed iteration
+    double currentError = 0;                      // Error of the last completed iteration
+    double validationAccuracy = -1;               // Latest validation accuracy; none if negative
     int maxIterations;                            // Total number of iterations
+    Metrics::Snapshot last;                       // Snapshot of the previous report
+    double lastElapsed = 0;
+    int lastIteration = -1;
     std::chrono::time_point<std::chrono::steady_clock> startTime; // Start time of logging
 };
 
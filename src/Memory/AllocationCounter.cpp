@@ -0,0 +1,128 @@
+#include "AllocationCounter.h"
+
+#include <atomic>
+#include <cerrno>
+#include <cstddef>
+#include <new>
+
+#ifndef PERCEPTRON_COUNT_ALLOCATIONS
+#error "AllocationCounter.cpp needs PERCEPTRON_COUNT_ALLOCATIONS, or its counters are hidden from the header"
+#endif
+
+namespace {
+    std::atomic<std::uint64_t> processCount{0};
+    std::atomic<std::uint64_t> processBytes{0};
+    thread_local std::uint64_t threadCount = 0;
+    thread_local std::uint64_t threadBytes = 0;
+
+    inline void record(std::size_t size) {
+        processCount.fetch_add(1, std::memory_order_relaxed);
+        processBytes.fetch_add(size, std::memory_order_relaxed);
+        ++threadCount;
+        threadBytes += size;
+    }
+}
+
+namespace Memory {
+    AllocationStats threadAllocations() {
+        return {threadCount, threadBytes};
+    }
+
+    AllocationStats processAllocations() {
+        return {processCount.load(std::memory_order_relaxed), processBytes.load(std::memory_order_relaxed)};
+    }
+}
+
+#if defined(__GLIBC__)
+// Interpose the malloc family and forward to glibc's implementation.
+extern "C" {
+void *__libc_malloc(std::size_t size);
+void *__libc_calloc(std::size_t count, std::size_t size);
+void *__libc_realloc(void *ptr, std::size_t size);
+void *__libc_memalign(std::size_t alignment, std::size_t size);
+void *__libc_valloc(std::size_t size);
+void *__libc_pvalloc(std::size_t size);
+void __libc_free(void *ptr);
+
+void *malloc(std::size_t size) noexcept {
+    record(size);
+    return __libc_malloc(size);
+}
+
+void *calloc(std::size_t count, std::size_t size) noexcept {
+    record(count * size);
+    return __libc_calloc(count, size);
+}
+
+void *realloc(void *ptr, std::size_t size) noexcept {
+    record(size);
+    return __libc_realloc(ptr, size);
+}
+
+void *memalign(std::size_t alignment, std::size_t size) noexcept {
+    record(size);
+    return __libc_memalign(alignment, size);
+}
+
+void *aligned_alloc(std::size_t alignment, std::size_t size) noexcept {
+    record(size);
+    return __libc_memalign(alignment, size);
+}
+
+int posix_memalign(void **ptr, std::size_t alignment, std::size_t size) noexcept {
+    if (alignment % sizeof(void *) != 0 || (alignment & (alignment - 1)) != 0 || alignment == 0) {
+        return EINVAL;
+    }
+    record(size);
+    void *result = __libc_memalign(alignment, size);
+    if (result == nullptr) {
+        return ENOMEM;
+    }
+    *ptr = result;
+    return 0;
+}
+
+void *valloc(std::size_t size) noexcept {
+    record(size);
+    return __libc_valloc(size);
+}
+
+void *pvalloc(std::size_t size) noexcept {
+    record(size);
+    return __libc_pvalloc(size);
+}
+
+void *reallocarray(void *ptr, std::size_t count, std::size_t size) noexcept {
+    std::size_t bytes;
+    if (__builtin_mul_overflow(count, size, &bytes)) {
+        errno = ENOMEM;
+        return nullptr;
+    }
+    record(bytes);
+    return __libc_realloc(ptr, bytes);
+}
+
+void free(void *ptr) noexcept {
+    __libc_free(ptr);
+}
+}
+#else
+#include <cstdlib>
+
+// Without glibc only operator new can be observed portably.
+void *operator new(std::size_t size) {
+    record(size);
+    if (void *ptr = std::malloc(size)) {
+        return ptr;
+    }
+    throw std::bad_alloc();
+}
+
+void operator delete(void *ptr) noexcept {
+    std::free(ptr);
+}
+
+void operator delete(void *ptr, std::size_t) noexcept {
+    std::free(ptr);
+}
+#endif
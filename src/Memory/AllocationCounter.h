@@ -0,0 +1,45 @@
+#ifndef PERCEPTRON_ALLOCATIONCOUNTER_H
+#define PERCEPTRON_ALLOCATIONCOUNTER_H
+
+#pragma once
+
+#include <cstdint>
+
+// Heap allocation statistics. On glibc every malloc-family call is counted (this includes operator new
+// and Eigen's aligned allocations); elsewhere only operator new is seen. Counting replaces the allocator entry
+// points of the whole process, so only executables that compile AllocationCounter.cpp with
+// PERCEPTRON_COUNT_ALLOCATIONS defined count; everywhere else countingEnabled is false and the counters stay zero.
+namespace Memory {
+    struct AllocationStats {
+        std::uint64_t count = 0;
+        std::uint64_t bytes = 0;
+    };
+
+    inline AllocationStats &operator+=(AllocationStats &lhs, const AllocationStats &rhs) {
+        lhs.count += rhs.count;
+        lhs.bytes += rhs.bytes;
+        return lhs;
+    }
+
+    inline AllocationStats operator-(const AllocationStats &lhs, const AllocationStats &rhs) {
+        return {lhs.count - rhs.count, lhs.bytes - rhs.bytes};
+    }
+
+#ifdef PERCEPTRON_COUNT_ALLOCATIONS
+    constexpr bool countingEnabled = true;
+
+    // Allocations made by the calling thread since it started.
+    AllocationStats threadAllocations();
+
+    // Allocations made by all threads since process start.
+    AllocationStats processAllocations();
+#else
+    constexpr bool countingEnabled = false;
+
+    inline AllocationStats threadAllocations() { return {}; }
+
+    inline AllocationStats processAllocations() { return {}; }
+#endif
+}
+
+#endif //PERCEPTRON_ALLOCATIONCOUNTER_H
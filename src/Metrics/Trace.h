@@ -0,0 +1,154 @@
+#ifndef PERCEPTRON_TRACE_H
+#define PERCEPTRON_TRACE_H
+
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <fstream>
+#include <iomanip>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+// Timeline tracing in the Chrome trace-event format, readable by chrome://tracing and ui.perfetto.dev. Built
+// with -DPERCEPTRON_TRACE=ON, TRACE_SCOPE records the lifetime of its scope as one complete event on the track of
+// the calling thread; otherwise the macros compile to nothing. Every thread owns a fixed ring buffer of events and
+// is its only writer, so recording is two clock reads and a store without locks; once a ring is full, the oldest
+// events are overwritten. Scope names must be string literals.
+namespace Trace {
+#ifdef PERCEPTRON_TRACE
+    inline constexpr bool enabled = true;
+#else
+    inline constexpr bool enabled = false;
+#endif
+
+    using Clock = std::chrono::steady_clock;
+
+    struct Event {
+        const char *name;
+        std::int64_t begin; // Nanoseconds since the clock's epoch
+        std::int64_t end;
+    };
+
+    class Track {
+    public:
+        static constexpr std::uint64_t capacity = 1 << 16;
+
+        explicit Track(int id) : id(id), name("thread " + std::to_string(id)), events(capacity) {}
+
+        void record(const char *eventName, std::int64_t begin, std::int64_t end) {
+            const std::uint64_t index = count.load(std::memory_order_relaxed);
+            events[index % capacity] = {eventName, begin, end};
+            count.store(index + 1, std::memory_order_release);
+        }
+
+    private:
+        friend class Recorder;
+        int id;
+        std::string name;
+        std::vector<Event> events;
+        std::atomic<std::uint64_t> count{0};
+    };
+
+    // Process-wide owner of the tracks. Tracks outlive their threads, so events of finished workers are kept.
+    class Recorder {
+    public:
+        static Recorder &instance() {
+            static Recorder recorder;
+            return recorder;
+        }
+
+        // Track of the calling thread, created on first use.
+        Track &track() {
+            thread_local Track *current = nullptr;
+            if (!current) {
+                std::lock_guard<std::mutex> lock(mutex);
+                tracks.push_back(std::make_unique<Track>(static_cast<int>(tracks.size())));
+                current = tracks.back().get();
+            }
+            return *current;
+        }
+
+        void nameThread(const std::string &name) {
+            Track &current = track();
+            std::lock_guard<std::mutex> lock(mutex);
+            current.name = name;
+        }
+
+        // Writes all recorded events as a trace-event JSON file and returns whether that succeeded. Traced threads
+        // should be idle; events recorded meanwhile may be missing.
+        bool write(const std::string &path) {
+            std::ofstream file(path, std::ios::trunc);
+            file << std::fixed << std::setprecision(3);
+            file << "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n";
+            std::lock_guard<std::mutex> lock(mutex);
+            std::int64_t origin = INT64_MAX;
+            for (const auto &track : tracks) {
+                const std::uint64_t count = track->count.load(std::memory_order_acquire);
+                for (std::uint64_t i = count > Track::capacity ? count - Track::capacity : 0; i < count; ++i) {
+                    origin = std::min(origin, track->events[i % Track::capacity].begin);
+                }
+            }
+            bool first = true;
+            for (const auto &track : tracks) {
+                file << (first ? "" : ",\n") << R"({"name":"thread_name","ph":"M","pid":1,"tid":)" << track->id
+                     << R"(,"args":{"name":")" << track->name << "\"}}";
+                first = false;
+                const std::uint64_t count = track->count.load(std::memory_order_acquire);
+                for (std::uint64_t i = count > Track::capacity ? count - Track::capacity : 0; i < count; ++i) {
+                    const Event &event = track->events[i % Track::capacity];
+                    // Microseconds with nanosecond resolution
+                    file << ",\n" << R"({"name":")" << event.name << R"(","ph":"X","pid":1,"tid":)" << track->id
+                         << ",\"ts\":" << static_cast<double>(event.begin - origin) / 1000
+                         << ",\"dur\":" << static_cast<double>(event.end - event.begin) / 1000 << '}';
+                }
+            }
+            file << "\n]}\n";
+            return static_cast<bool>(file.flush());
+        }
+
+    private:
+        std::mutex mutex;
+        std::vector<std::unique_ptr<Track>> tracks;
+    };
+
+    inline std::int64_t now() {
+        return std::chrono::duration_cast<std::chrono::nanoseconds>(Clock::now().time_since_epoch()).count();
+    }
+
+    // Records the lifetime of the scope on the calling thread's track.
+    class Scope {
+    public:
+        explicit Scope(const char *name) : name(name), begin(now()) {}
+
+        Scope(const Scope &other) = delete;
+        Scope &operator=(const Scope &other) = delete;
+
+        ~Scope() {
+            Recorder::instance().track().record(name, begin, now());
+        }
+
+    private:
+        const char *name;
+        std::int64_t begin;
+    };
+}
+
+#define TRACE_CONCAT_(a, b) a##b
+#define TRACE_CONCAT(a, b) TRACE_CONCAT_(a, b)
+
+#ifdef PERCEPTRON_TRACE
+// Records the rest of the enclosing scope as an event named name
+#define TRACE_SCOPE(name) const ::Trace::Scope TRACE_CONCAT(traceScope, __LINE__)(name)
+// Names the calling thread's track
+#define TRACE_THREAD_NAME(name) ::Trace::Recorder::instance().nameThread(name)
+#else
+#define TRACE_SCOPE(name) static_cast<void>(0)
+#define TRACE_THREAD_NAME(name) static_cast<void>(0)
+#endif
+
+#endif //PERCEPTRON_TRACE_H
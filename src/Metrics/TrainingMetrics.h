@@ -0,0 +1,108 @@
+#ifndef PERCEPTRON_TRAININGMETRICS_H
+#define PERCEPTRON_TRAININGMETRICS_H
+
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <memory>
+
+// Low-overhead training metrics. Every training thread owns one cache-line aligned ThreadCounters slot and is its
+// only writer, so updates are plain relaxed load/store pairs without locked instructions or contention. A reader
+// (the LoopLogger thread) sums all slots whenever it wants a Snapshot; values may be a few batches stale.
+namespace Metrics {
+    enum class Phase : int {
+        Data,     // gathering a batch or waiting for the batch pipeline
+        Forward,  // forward pass and loss
+        Backward, // backward pass
+        Reduce,   // summing the shard gradients of data-parallel training
+        Update,   // normalizing gradients and updating the weights
+        Count
+    };
+
+    inline constexpr std::array<const char *, static_cast<int>(Phase::Count)> phaseNames = {
+            "data", "forward", "backward", "reduce", "update"};
+
+    struct alignas(64) ThreadCounters {
+        std::atomic<std::uint64_t> samples{0};
+        std::atomic<std::uint64_t> batches{0};
+        std::atomic<std::uint64_t> flops{0};
+        std::atomic<std::uint64_t> allocations{0};
+        std::array<std::atomic<std::uint64_t>, static_cast<int>(Phase::Count)> phaseNanoseconds{};
+
+        // Single-writer increment
+        static void add(std::atomic<std::uint64_t> &counter, std::uint64_t value) {
+            counter.store(counter.load(std::memory_order_relaxed) + value, std::memory_order_relaxed);
+        }
+
+        void addTime(Phase phase, std::chrono::steady_clock::duration time) {
+            add(phaseNanoseconds[static_cast<int>(phase)],
+                static_cast<std::uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(time).count()));
+        }
+    };
+
+    // Adds the lifetime of the scope to a phase of counters; does nothing when counters is null.
+    class ScopedPhase {
+    public:
+        ScopedPhase(ThreadCounters *counters, Phase phase) : counters(counters), phase(phase) {
+            if (counters) {
+                start = std::chrono::steady_clock::now();
+            }
+        }
+
+        ScopedPhase(const ScopedPhase &other) = delete;
+        ScopedPhase &operator=(const ScopedPhase &other) = delete;
+
+        ~ScopedPhase() {
+            if (counters) {
+                counters->addTime(phase, std::chrono::steady_clock::now() - start);
+            }
+        }
+
+    private:
+        ThreadCounters *counters;
+        Phase phase;
+        std::chrono::steady_clock::time_point start;
+    };
+
+    // Totals over all threads. Phase times are summed thread time, not wall time.
+    struct Snapshot {
+        std::uint64_t samples = 0;
+        std::uint64_t batches = 0;
+        std::uint64_t flops = 0;
+        std::uint64_t allocations = 0;
+        std::array<std::uint64_t, static_cast<int>(Phase::Count)> phaseNanoseconds{};
+    };
+
+    class TrainingMetrics {
+    public:
+        explicit TrainingMetrics(int threadCount)
+                : threadCount(threadCount), counters(std::make_unique<ThreadCounters[]>(threadCount)) {}
+
+        // Counters of training thread t; only that thread may write to them.
+        [[nodiscard]] ThreadCounters &thread(int t) { return counters[t]; }
+
+        [[nodiscard]] Snapshot snapshot() const {
+            Snapshot total;
+            for (int t = 0; t < threadCount; ++t) {
+                const ThreadCounters &slot = counters[t];
+                total.samples += slot.samples.load(std::memory_order_relaxed);
+                total.batches += slot.batches.load(std::memory_order_relaxed);
+                total.flops += slot.flops.load(std::memory_order_relaxed);
+                total.allocations += slot.allocations.load(std::memory_order_relaxed);
+                for (std::size_t p = 0; p < total.phaseNanoseconds.size(); ++p) {
+                    total.phaseNanoseconds[p] += slot.phaseNanoseconds[p].load(std::memory_order_relaxed);
+                }
+            }
+            return total;
+        }
+
+    private:
+        int threadCount;
+        std::unique_ptr<ThreadCounters[]> counters;
+    };
+}
+
+#endif //PERCEPTRON_TRAININGMETRICS_H
@@ -1,123 +1,432 @@
 #include <iostream>
+#include <optional>
+#include "Distributed/RingAllReduce.h"
 #include "Network/Components.h"
 #include "DataHandling.h"
 #include "LoopLogger.h"
+#include "Network/Checkpoint.h"
+#include "Network/Quantized.h"
+#include "PredictionLogWriter.h"
+#include "Memory/AllocationCounter.h"
+#include "Metrics/Trace.h"
+#include "Metrics/TrainingMetrics.h"
+#include "Training/BatchPipeline.h"
+#include "Training/DataParallelTrainer.h"
+#include "Training/HogwildTrainer.h"
+#include "Training/Validator.h"
+#include "Tuning/Autotuner.h"
 
 
-int main(const int argc, char *argv[]) {
-    if (argc != 2) {
-        std::cout << "Usage: " << argv[0] << " <path_to_config_file>" << std::endl;
-        return 1;
+// Prints the steady-state allocation count (in builds that count allocations), throughput and thread busy time of a
+// finished training run.
+template<typename Trainer>
+void reportTraining(const Trainer& trainer) {
+    if constexpr (Memory::countingEnabled) {
+        const Memory::AllocationStats steady_state_allocations = trainer.steadyStateAllocations();
+        std::cout << "Steady-state heap allocations: " << steady_state_allocations.count << " ("
+                  << steady_state_allocations.bytes << " bytes) over " << trainer.steadyStateSteps()
+                  << " training steps" << std::endl;
     }
-    std::string config_path = argv[1];
-    int num_epochs = 0;
-    int batch_size = 0;
-    int hidden_size = 0;
-    double learning_rate = 0.0;
-    std::string rel_path_train_images;
-    std::string rel_path_train_labels;
-    std::string rel_path_test_images;
-    std::string rel_path_test_labels;
-    std::string rel_path_log_file;
+    const std::ios_base::fmtflags flags = std::cout.flags();
+    const std::streamsize precision = std::cout.precision();
+    std::cout << "Training threads: " << trainer.threadCount() << ", throughput: " << std::fixed
+              << std::setprecision(0) << trainer.samplesPerSecond() << " samples/s, threads busy: "
+              << std::setprecision(1) << trainer.busyFraction() * 100 << "% of wall time" << std::endl;
+    std::cout.flags(flags);
+    std::cout.precision(precision);
+}
 
-    std::cout << "Reading config file..." << std::endl;
-    if (!Utils::parseConfigFile(config_path, num_epochs, batch_size, hidden_size, learning_rate,
-                                rel_path_train_images, rel_path_train_labels,
-                                rel_path_test_images, rel_path_test_labels,
-                                rel_path_log_file)) {
-        return 1;
+// Prints the validation accuracy of every epoch and the best one.
+template<typename T, typename Master>
+void reportValidation(const std::vector<typename Validator<T, Master>::Result>& history,
+                      const typename Validator<T, Master>::Result& best) {
+    const std::ios_base::fmtflags flags = std::cout.flags();
+    const std::streamsize precision = std::cout.precision();
+    for (const auto& result : history) {
+        std::cout << "Validation accuracy after epoch " << result.epoch << ": " << std::fixed << std::setprecision(6)
+                  << result.accuracy << std::endl;
+    }
+    std::cout << "Best validation accuracy: " << best.accuracy << " after epoch " << best.epoch << std::endl;
+    std::cout.flags(flags);
+    std::cout.precision(precision);
+}
+
+// Classifies the test set with the int8-quantized network, fed straight from the mapped uint8 pixels, and compares
+// accuracy, inference throughput and weight memory with the full-precision pass.
+template<typename T, typename Master>
+void reportQuantized(const Network<T, Master>& network, const MNISTLoader<T>& test_loader, int chunk_size,
+                     int float_correct, double float_seconds) {
+    const QuantizedNetwork quantized(network);
+    auto workspace = quantized.makeWorkspace(chunk_size);
+    const int num_images = test_loader.imageCount();
+    int correct = 0;
+    double seconds = 0;
+    for (int i = 0; i < num_images; i += chunk_size) {
+        const int current_chunk_size = std::min(chunk_size, num_images - i);
+        const auto start = std::chrono::steady_clock::now();
+        const auto logits = quantized.forward(test_loader.rawImage(i), current_chunk_size, workspace);
+        seconds += std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        for (int j = 0; j < current_chunk_size; ++j) {
+            Eigen::Index prediction;
+            logits.row(j).maxCoeff(&prediction);
+            correct += static_cast<int>(prediction) == test_loader.rawLabel(i + j);
+        }
+    }
+
+    std::size_t float_bytes = 0;
+    for (std::size_t l = 0; l < network.layerCount(); ++l) {
+        float_bytes += (network.layer(l).parameterWeights().size() + network.layer(l).parameterBiases().size()) *
+                       sizeof(T);
+    }
+    const double accuracy = static_cast<double>(correct) / num_images;
+    const double float_accuracy = static_cast<double>(float_correct) / num_images;
+    const std::ios_base::fmtflags flags = std::cout.flags();
+    const std::streamsize precision = std::cout.precision();
+    std::cout << "Int8 accuracy: " << std::fixed << std::setprecision(6) << accuracy << " (delta "
+              << std::showpos << accuracy - float_accuracy << std::noshowpos << " against " << float_accuracy
+              << ")" << std::endl;
+    std::cout << "Inference throughput: " << std::setprecision(0) << num_images / float_seconds << " images/s "
+              << (std::is_same_v<T, float> ? "float" : "double") << ", " << num_images / seconds
+              << " images/s int8; parameters: " << float_bytes << " bytes, " << quantized.parameterBytes()
+              << " bytes int8" << std::endl;
+    std::cout.flags(flags);
+    std::cout.precision(precision);
+}
+
+// Applies the autotuned settings for network to config, measuring them first unless the cache has them (autotune
+// "on"). The network keeps the per-sample step size of the configured batch size.
+template<typename T, typename Master>
+void autotune(Network<T, Master>& network, const MNISTLoader<T>& train_loader, Utils::Config& config) {
+    const std::string key = Autotune::cacheKey(network, config);
+    std::optional<Autotune::Settings> settings;
+    if (config.autotune == "on") {
+        settings = Autotune::lookup(config.autotune_cache, key);
     }
+    const bool cached = settings.has_value();
+    if (!cached) {
+        std::cout << "Autotuning..." << std::endl;
+        TRACE_SCOPE("autotune");
+        settings = Autotune::tune(network, train_loader, config);
+        try {
+            Autotune::store(config.autotune_cache, key, *settings);
+        } catch (const std::exception& e) {
+            std::cerr << "Warning: " << e.what() << std::endl;
+        }
+    }
+
+    network.setBatchSizeCompensation(config.batch_size, settings->batchSize);
+    config.batch_size = settings->batchSize;
+    config.num_threads = settings->threadCount;
+    Compute::selectBackend(settings->backend);
+    config.compute_backend = Compute::backendName(settings->backend);
+    config.sparse_input.mode = settings->sparseMode;
+    network.setSparseInput(config.sparse_input);
+    std::cout << "Autotuned (" << (cached ? "cached" : "measured") << "): batch_size " << config.batch_size
+              << ", num_threads " << config.num_threads << ", compute_backend "
+              << Compute::backendName(Compute::gemmBackend<T>())
+              << ", sparse_input " << SparseInput::modeName(config.sparse_input.mode) << ", "
+              << static_cast<long long>(settings->samplesPerSecond) << " samples/s" << std::endl;
+}
 
-    // Load training data
-    std::cout << "Loading data..." << std::endl;
-    MNISTLoader train_loader;
-    train_loader.loadImages(rel_path_train_images);
-    train_loader.loadLabels(rel_path_train_labels);
-    const Matrix& train_images = train_loader.images();
-    const Matrix& train_labels = train_loader.labels();
+// Trains the network from start_epoch up to the configured number of epochs, writing checkpoints if configured.
+// With a held-out split in train_loader, every epoch is validated in the background, training stops early once the
+// accuracy plateaus (if configured) and the network ends up with the parameters of the best epoch.
+template<typename T, typename Master>
+void train(Network<T, Master>& network, const MNISTLoader<T>& train_loader, const Utils::Config& config,
+           int start_epoch) {
+    const int num_epochs = config.num_epochs;
+    const int batch_size = config.batch_size;
+    const auto learning_rate = static_cast<Master>(config.learning_rate);
+    const int num_train = train_loader.imageCount();
 
-    // Create the model
-    Network network;
-    network.addLayer(784, hidden_size, Activation::relu, Activation::reluDerivative);
-    network.addLayer(hidden_size, 10, Activation::identity, Activation::identityDerivative);
+    network.reserve(batch_size);
+
+    // Saves a checkpoint after every checkpoint_interval epochs and after the last one. All ranks of a distributed
+    // run hold the same weights, so only rank 0 writes.
+    auto checkpoint = [&](int completed_epochs, bool last) {
+        if (!config.checkpoint_path.empty() && config.rank == 0 &&
+            (completed_epochs % config.checkpoint_interval == 0 || completed_epochs == num_epochs || last)) {
+            Checkpoint::save(network, config.checkpoint_path, static_cast<std::uint64_t>(completed_epochs));
+        }
+    };
 
-    LoopLogger logger(num_epochs);
+    // Each rank of a distributed run only trains on its slice of every batch
+    const long long rank_rows = config.training_mode == "hogwild"
+                                ? num_train
+                                : BatchPipeline<T>::sliceRowsPerEpoch(num_train, batch_size, config.rank,
+                                                                      config.world_size);
+    Metrics::TrainingMetrics metrics(config.num_threads);
+    LoopLogger logger(num_epochs, metrics,
+                      {start_epoch, rank_rows, config.rank == 0 ? config.metrics_path : std::string(),
+                       std::chrono::milliseconds(config.metrics_interval_ms)});
+
+    // Validation results are the same on every rank of a distributed run, so all ranks stop after the same epoch
+    std::optional<Validator<T, Master>> validator;
+    if (train_loader.heldOutCount() > 0) {
+        validator.emplace(network, train_loader, num_train, train_loader.heldOutCount(), config.eval_batch_size,
+                          config.early_stopping_patience);
+    }
+
+    // Reports the finished epoch and hands its parameters to the validator; returns whether to go on training.
+    // The early-stopping decision uses the results up to the previous epoch, whose validation overlapped with
+    // this one.
+    auto endEpoch = [&](int completed_epochs, double mean_loss) {
+        logger.updateProgress(completed_epochs, mean_loss);
+        bool stop = false;
+        if (validator) {
+            const auto& history = validator->wait();
+            if (!history.empty()) {
+                logger.updateValidation(history.back().accuracy);
+            }
+            stop = validator->plateaued();
+            validator->submit(network, completed_epochs);
+        }
+        checkpoint(completed_epochs, stop);
+        return !stop;
+    };
+
+    // Reports the validation results and keeps the parameters of the best epoch for testing
+    auto finishValidation = [&]() {
+        if (!validator) {
+            return;
+        }
+        const auto& history = validator->wait();
+        if (history.back().epoch < num_epochs) {
+            std::cout << "Stopped early after epoch " << history.back().epoch << std::endl;
+        }
+        reportValidation<T, Master>(history, validator->bestResult());
+        Validator<T, Master>::copyParameters(validator->bestNetwork(), network);
+    };
 
     // Train the model
     std::cout << "Training..." << std::endl;
-    for (int epoch = 0; epoch < num_epochs; ++epoch) {
-        Precision total_loss = 0;
-
-        for (int i = 0; i < train_images.rows(); i += batch_size) {
-            int current_batch_size = std::min(batch_size, static_cast<int>(train_images.rows() - i));
-            Matrix batch_images = train_images.middleRows(i, current_batch_size);
-            Matrix batch_labels = train_labels.middleRows(i, current_batch_size);
-
-            // Forward pass
-            Matrix logits = network.forward(batch_images);
-            Matrix predictions = Activation::softmax(logits);
-
-            // Compute loss
-            Vector batch_loss = Loss::crossEntropy(predictions, batch_labels);
-            total_loss += batch_loss.sum();
-
-            // Backward pass
-            Matrix gradOutput = Loss::softmaxCrossEntropyDerivative(logits, batch_labels);
-            network.backward(gradOutput);
-            network.updateWeights(learning_rate);
+    if (config.training_mode == "hogwild") {
+        HogwildTrainer<T, Master> trainer(network, config.num_threads, batch_size, &metrics);
+        std::vector<int> order;
+        for (int epoch = start_epoch; epoch < num_epochs; ++epoch) {
+            epochOrder(num_train, config.shuffle, config.seed, epoch, order);
+            const double mean_loss = trainer.trainEpoch(train_loader, order, learning_rate, config.loss_interval);
+            if (!endEpoch(epoch + 1, mean_loss)) {
+                break;
+            }
+        }
+        logger.waitForCompletion();
+        reportTraining(trainer);
+        finishValidation();
+    } else {
+        // Every rank of a distributed run trains on its slice of each batch and joins the gradient all-reduce
+        std::optional<RingAllReduce> ring;
+        if (config.world_size > 1) {
+            std::cout << "Connecting rank " << config.rank << " of " << config.world_size << "..." << std::endl;
+            ring.emplace(config.rank, config.world_size, config.ring_hosts, config.ring_port);
         }
+        DataParallelTrainer<T, Master> trainer(network, config.num_threads, batch_size, &metrics,
+                                               ring ? &*ring : nullptr);
+        BatchPipeline<T> pipeline(train_loader, batch_size, start_epoch, num_epochs, config.prefetch_batches,
+                                  config.shuffle, config.seed, config.rank, config.world_size);
+        for (int epoch = start_epoch; epoch < num_epochs; ++epoch) {
+            double total_loss = 0;
+            long long loss_rows = 0;
 
-        logger.updateProgress(epoch+1, total_loss / train_images.rows());
+            for (int i = 0; i < pipeline.batchesPerEpoch(); ++i) {
+                const auto& batch = [&]() -> const auto& {
+                    Metrics::ScopedPhase phase(&metrics.thread(0), Metrics::Phase::Data);
+                    TRACE_SCOPE("wait_batch");
+                    return pipeline.acquire();
+                }();
+                // Forward pass, loss, backward pass and update, split across the trainer threads
+                const bool compute_loss = i % config.loss_interval == 0;
+                total_loss += trainer.step(pipeline.images(batch), pipeline.labels(batch), learning_rate,
+                                           compute_loss);
+                loss_rows += compute_loss ? batch.batchRows : 0;
+                pipeline.release();
+            }
+
+            if (!endEpoch(epoch + 1, total_loss / loss_rows)) {
+                break;
+            }
+        }
+        logger.waitForCompletion();
+        reportTraining(trainer);
+        std::cout << "Time waiting for batches: "
+                  << std::chrono::duration<double>(pipeline.waitTime()).count() << " s" << std::endl;
+        finishValidation();
     }
+}
 
-    logger.waitForCompletion();
+// Whether a network resumed from a checkpoint fits the images of a data set and the 10 digit classes. A hidden layer
+// width that differs from hidden_size only gets a warning: the checkpoint's topology wins.
+template<typename T, typename Master>
+bool checkResumedShape(const Network<T, Master>& network, const MNISTLoader<T>& loader, const Utils::Config& config,
+                       const std::string& data_path) {
+    if (network.layer(0).inputSize() != loader.imageSize()) {
+        std::cerr << "Error: checkpoint " << config.resume_from_checkpoint << " expects images of "
+                  << network.layer(0).inputSize() << " pixels, " << data_path << " has " << loader.imageSize()
+                  << std::endl;
+        return false;
+    }
+    const auto classes = network.layer(network.layerCount() - 1).outputSize();
+    if (classes != 10) {
+        std::cerr << "Error: checkpoint " << config.resume_from_checkpoint << " has " << classes
+                  << " outputs, expected 10" << std::endl;
+        return false;
+    }
+    if (config.hidden_size > 0 && network.layerCount() > 1 && network.layer(0).outputSize() != config.hidden_size) {
+        std::cerr << "Warning: checkpoint hidden layer has " << network.layer(0).outputSize()
+                  << " units; ignoring hidden_size " << config.hidden_size << std::endl;
+    }
+    return true;
+}
 
-    // Load test data
-    std::cout << "Testing..." << std::endl;
-    MNISTLoader test_loader;
-    test_loader.loadImages(rel_path_test_images);
-    test_loader.loadLabels(rel_path_test_labels);
-    const Matrix& test_images = test_loader.images();
-    const Matrix& test_labels = test_loader.labels();
-    int numImages = test_loader.imageCount();
+// Trains and tests the model with compute precision T and master weight precision Master.
+template<typename T, typename Master = T>
+int run(const Utils::Config& config) {
+    const int batch_size = config.batch_size;
+    std::cout << "Compute backend: " << Compute::backendName(Compute::gemmBackend<T>()) << std::endl;
+
+    Network<T, Master> network;
+    network.setSeed(config.seed);
+    network.setOptimizer(config.optimizer);
+    network.setSparseInput(config.sparse_input);
+    int start_epoch = 0;
+    if (!config.resume_from_checkpoint.empty()) {
+        std::cout << "Loading checkpoint..." << std::endl;
+        start_epoch = static_cast<int>(Checkpoint::load(network, config.resume_from_checkpoint).epoch);
+        std::cout << "Resuming after epoch " << start_epoch << std::endl;
+    }
 
-    Matrix predictions = Activation::softmax(network.forward(test_images));
+    if (start_epoch < config.num_epochs) {
+        // Load training data
+        std::cout << "Loading data..." << std::endl;
+        MNISTLoader<T> train_loader;
+        train_loader.mapImages(config.rel_path_train_images);
+        train_loader.mapLabels(config.rel_path_train_labels);
+        train_loader.holdOut(static_cast<int>(config.validation_split * train_loader.imageCount()));
+
+        // Create the model
+        if (network.layerCount() == 0) {
+            network.addLayer(train_loader.imageSize(), config.hidden_size, Activation::ReLU{});
+            network.addLayer(config.hidden_size, 10, Activation::Identity{});
+        } else if (!checkResumedShape(network, train_loader, config, config.rel_path_train_images)) {
+            return 1;
+        }
 
-    Eigen::VectorXi pred_indices(predictions.rows());
-    Eigen::VectorXi label_indices(test_labels.rows());
+        Utils::Config training_config = config;
+        if (config.autotune != "off") {
+            autotune(network, train_loader, training_config);
+        }
+        train(network, train_loader, training_config, start_epoch);
+    }
 
-    for (int i = 0; i < predictions.rows(); ++i) {
-        Eigen::MatrixXd::Index maxIndexPred, maxIndexLabel;
-        predictions.row(i).maxCoeff(&maxIndexPred);
-        test_labels.row(i).maxCoeff(&maxIndexLabel);
-        pred_indices(i) = maxIndexPred;
-        label_indices(i) = maxIndexLabel;
+    // Rank 0 of a distributed run tests the model and writes the log
+    if (config.rank != 0) {
+        std::cout << "Done!" << std::endl;
+        return 0;
     }
 
-    int correct = 0;
-    int batchNum = 0;
-    std::fstream logFile(rel_path_log_file, std::ios::out);
-    if (!logFile) {
+    // Load test data
+    std::cout << "Testing..." << std::endl;
+    MNISTLoader<T> test_loader;
+    test_loader.mapImages(config.rel_path_test_images);
+    test_loader.mapLabels(config.rel_path_test_labels);
+    if (!config.resume_from_checkpoint.empty() &&
+        !checkResumedShape(network, test_loader, config, config.rel_path_test_images)) {
+        return 1;
+    }
+    int numImages = test_loader.imageCount();
+
+    PredictionLogWriter logFile(config.rel_path_log_file, batch_size, config.eval_batch_size);
+    if (!logFile.isOpen()) {
         std::cerr << "Error: Could not open log file" << std::endl;
         return 1;
     }
+
+    // Stream over the test set in fixed-size chunks so memory does not grow with the test set. The prediction is
+    // the argmax of the logits; softmax does not change it.
     std::cout << "Writing to log file..." << std::endl;
-    for (int i = 0; i < numImages; i += batch_size) {
-        logFile << "Current batch: " << batchNum << std::endl;
-        batchNum++;
-        int current_batch_size = std::min(batch_size, static_cast<int>(test_images.rows() - i));
-        Eigen::VectorXi batch_predictions = pred_indices.segment(i,current_batch_size);
-        Eigen::VectorXi batch_labels = label_indices.segment(i, current_batch_size);
-        for (int j = 0; j < current_batch_size; ++j) {
-            logFile<<" - image "<<i+j<< ": Prediction=" << batch_predictions(j) << ". Label=" << batch_labels(j) << std::endl;
-            if (batch_predictions(j) == batch_labels(j)) {
+    const int chunk_size = config.eval_batch_size;
+    auto workspace = network.makeWorkspace(chunk_size);
+    Buffer<T> chunk_images;
+    chunk_images.reserve(static_cast<Eigen::Index>(chunk_size) * test_loader.imageSize());
+    std::vector<int> pred_indices(chunk_size);
+    std::vector<int> label_indices(chunk_size);
+    int correct = 0;
+    double forward_seconds = 0;
+    for (int i = 0; i < numImages; i += chunk_size) {
+        TRACE_SCOPE("test_chunk");
+        const int current_chunk_size = std::min(chunk_size, numImages - i);
+        const auto start = std::chrono::steady_clock::now();
+        auto images = chunk_images.view(current_chunk_size, test_loader.imageSize());
+        test_loader.copyImageBatch(i, current_chunk_size, images);
+        const auto logits = network.forward(images, workspace);
+        forward_seconds += std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        for (int j = 0; j < current_chunk_size; ++j) {
+            Eigen::Index maxIndexPred;
+            logits.row(j).maxCoeff(&maxIndexPred);
+            pred_indices[j] = static_cast<int>(maxIndexPred);
+            label_indices[j] = test_loader.rawLabel(i + j);
+            if (pred_indices[j] == label_indices[j]) {
                 correct++;
             }
         }
+        logFile.write(i, pred_indices.data(), label_indices.data(), current_chunk_size);
+    }
+    if (!logFile.close()) {
+        std::cerr << "Error: Could not write log file" << std::endl;
+        return 1;
     }
 
-    std::cout << "Accuracy: " << static_cast<Precision>(correct) / numImages << std::endl;
+    std::cout << "Accuracy: " << std::fixed << std::setprecision(6) << static_cast<double>(correct) / numImages
+              << std::endl;
+    if (config.quantized_inference) {
+        reportQuantized(network, test_loader, chunk_size, correct, forward_seconds);
+    }
     std::cout << "Done!" << std::endl;
 
     return 0;
+}
+
+int main(const int argc, char *argv[]) {
+    if (argc != 2) {
+        std::cout << "Usage: " << argv[0] << " <path_to_config_file>" << std::endl;
+        return 1;
+    }
+    std::string config_path = argv[1];
+    Utils::Config config;
+
+    std::cout << "Reading config file..." << std::endl;
+    if (!Utils::parseConfigFile(config_path, config)) {
+        return 1;
+    }
+
+    if (config.compute_backend != "auto") {
+        try {
+            Compute::selectBackend(Compute::parseBackend(config.compute_backend));
+        } catch (const std::exception& e) {
+            std::cerr << "Error: " << e.what() << std::endl;
+            return 1;
+        }
+    }
+    std::cout << "Precision: " << config.precision << std::endl;
+    if (!config.trace_path.empty() && !Trace::enabled) {
+        std::cerr << "Warning: trace_path is ignored; tracing needs a build with -DPERCEPTRON_TRACE=ON" << std::endl;
+    }
+    TRACE_THREAD_NAME("main");
+    int status;
+    if (config.precision == "float") {
+        status = run<float>(config);
+    } else if (config.precision == "mixed") {
+        status = run<float, double>(config);
+    } else {
+        status = run<double>(config);
+    }
+
+    if (!config.trace_path.empty() && Trace::enabled) {
+        if (Trace::Recorder::instance().write(config.trace_path)) {
+            std::cout << "Trace written to " << config.trace_path << std::endl;
+        } else {
+            std::cerr << "Error: Could not write trace file " << config.trace_path << std::endl;
+        }
+    }
+    return status;
 }
\ No newline at end of file
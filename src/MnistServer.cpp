@@ -0,0 +1,177 @@
+#include <csignal>
+#include <cstring>
+#include <iostream>
+#include <list>
+#include <memory>
+#include <optional>
+#include <string>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include "Compute/Gemm.h"
+#include "Network/Checkpoint.h"
+#include "Serving/InferenceServer.h"
+
+// Long-lived classification server. Loads a checkpoint once and answers requests from stdin (default) or from
+// clients of a Unix domain socket; see InferenceSession for the line protocol. Requests of all clients are
+// classified in dynamic micro-batches. Latency statistics are printed to stderr at end of input or, for the
+// socket server, on SIGINT/SIGTERM, and can be queried at any time with a "stats" request.
+
+namespace {
+    volatile std::sig_atomic_t stopRequested = 0;
+
+    void requestStop(int) {
+        stopRequested = 1;
+    }
+
+    struct Options {
+        std::string checkpoint;
+        std::string socketPath;
+        std::string precision = "float";
+        std::string backend = "auto";
+        bool int8 = false;
+        int maxBatch = 64;
+        int maxWaitMicroseconds = 500;
+    };
+
+    struct Connection {
+        int fd;
+        std::atomic<bool> finished{false};
+        std::thread thread;
+    };
+
+    template<typename T>
+    void serveSocket(DynamicBatcher<T> &batcher, const Options &options, int window) {
+        const int listener = ::socket(AF_UNIX, SOCK_STREAM, 0);
+        sockaddr_un address{};
+        address.sun_family = AF_UNIX;
+        if (listener < 0 || options.socketPath.size() >= sizeof(address.sun_path)) {
+            throw std::runtime_error("Cannot create socket: " + options.socketPath);
+        }
+        std::strncpy(address.sun_path, options.socketPath.c_str(), sizeof(address.sun_path) - 1);
+        ::unlink(options.socketPath.c_str());
+        if (::bind(listener, reinterpret_cast<const sockaddr *>(&address), sizeof(address)) != 0 ||
+            ::listen(listener, SOMAXCONN) != 0) {
+            ::close(listener);
+            throw std::runtime_error("Cannot listen on socket: " + options.socketPath + ": " + std::strerror(errno));
+        }
+        std::cerr << "Listening on " << options.socketPath << std::endl;
+
+        std::list<std::unique_ptr<Connection>> connections;
+        while (!stopRequested) {
+            // SIGINT/SIGTERM may be delivered to any thread, so poll with a timeout instead of relying on EINTR
+            pollfd listening{listener, POLLIN, 0};
+            const int fd = ::poll(&listening, 1, 200) > 0 ? ::accept(listener, nullptr, nullptr) : -1;
+            connections.remove_if([](const std::unique_ptr<Connection> &connection) {
+                if (!connection->finished.load(std::memory_order_acquire)) {
+                    return false;
+                }
+                connection->thread.join();
+                ::close(connection->fd);
+                return true;
+            });
+            if (fd < 0) {
+                continue;
+            }
+            auto connection = std::make_unique<Connection>();
+            connection->fd = fd;
+            Connection &current = *connection;
+            current.thread = std::thread([&batcher, &current, window] {
+                InferenceSession<T>(batcher, current.fd, current.fd, window).run();
+                // Signal the end of the responses; the descriptor is closed when the thread is joined
+                ::shutdown(current.fd, SHUT_WR);
+                current.finished.store(true, std::memory_order_release);
+            });
+            connections.push_back(std::move(connection));
+        }
+
+        ::close(listener);
+        ::unlink(options.socketPath.c_str());
+        for (auto &connection : connections) {
+            // Ends the session's read loop and fails its writes, so a client that stopped reading cannot block
+            // the join; responses not yet written are dropped
+            ::shutdown(connection->fd, SHUT_RDWR);
+            connection->thread.join();
+            ::close(connection->fd);
+        }
+    }
+
+    template<typename T>
+    int serve(const Options &options) {
+        Network<T> network;
+        const Checkpoint::State state = Checkpoint::load(network, options.checkpoint);
+        std::cerr << "Loaded " << options.checkpoint << " (" << network.layerCount() << " layers, epoch "
+                  << state.epoch << "), " << Compute::backendName(Compute::gemmBackend<T>()) << " backend, max batch "
+                  << options.maxBatch << ", max wait " << options.maxWaitMicroseconds << " us" << std::endl;
+
+        std::optional<QuantizedNetwork> quantized;
+        if (options.int8) {
+            quantized.emplace(network);
+            std::cerr << "Serving the int8-quantized network (" << quantized->parameterBytes() << " bytes, "
+                      << Compute::backendName(Compute::activeBackend()) << " int8 kernels)" << std::endl;
+        }
+        DynamicBatcher<T> batcher(network, options.maxBatch, std::chrono::microseconds(options.maxWaitMicroseconds),
+                                  quantized ? &*quantized : nullptr);
+        // Enough in-flight requests per client to fill two batches
+        const int window = 2 * options.maxBatch;
+        if (options.socketPath.empty()) {
+            InferenceSession<T>(batcher, STDIN_FILENO, STDOUT_FILENO, window).run();
+        } else {
+            serveSocket(batcher, options, window);
+        }
+        std::cerr << batcher.stats() << std::endl;
+        return 0;
+    }
+}
+
+int main(int argc, char *argv[]) {
+    Options options;
+    for (int i = 1; i < argc; ++i) {
+        const std::string argument = argv[i];
+        if (argument == "--socket" && i + 1 < argc) {
+            options.socketPath = argv[++i];
+        } else if (argument == "--max-batch" && i + 1 < argc) {
+            options.maxBatch = std::stoi(argv[++i]);
+        } else if (argument == "--max-wait-us" && i + 1 < argc) {
+            options.maxWaitMicroseconds = std::stoi(argv[++i]);
+        } else if (argument == "--precision" && i + 1 < argc) {
+            options.precision = argv[++i];
+        } else if (argument == "--backend" && i + 1 < argc) {
+            options.backend = argv[++i];
+        } else if (argument == "--int8") {
+            options.int8 = true;
+        } else if (options.checkpoint.empty() && argument.rfind("--", 0) != 0) {
+            options.checkpoint = argument;
+        } else {
+            options.checkpoint.clear();
+            break;
+        }
+    }
+    if (options.checkpoint.empty() || options.maxBatch < 1 || options.maxWaitMicroseconds < 0 ||
+        (options.precision != "float" && options.precision != "double")) {
+        std::cout << "Usage: " << argv[0] << " <checkpoint> [--socket <path>] [--max-batch <n>] "
+                  << "[--max-wait-us <n>] [--precision float|double] [--backend auto|eigen|avx2|avx512] [--int8]"
+                  << std::endl;
+        return 1;
+    }
+
+    // The stdin server ends at end of input; the socket server stops on SIGINT/SIGTERM
+    if (!options.socketPath.empty()) {
+        struct sigaction action{};
+        action.sa_handler = requestStop;
+        sigemptyset(&action.sa_mask);
+        sigaction(SIGINT, &action, nullptr);
+        sigaction(SIGTERM, &action, nullptr);
+    }
+    std::signal(SIGPIPE, SIG_IGN);
+
+    try {
+        if (options.backend != "auto") {
+            Compute::selectBackend(Compute::parseBackend(options.backend));
+        }
+        return options.precision == "double" ? serve<double>(options) : serve<float>(options);
+    } catch (const std::exception &e) {
+        std::cerr << "Error: " << e.what() << std::endl;
+        return 1;
+    }
+}
@@ -0,0 +1,259 @@
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <mutex>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+#include "Compute/Gemm.h"
+#include "DataHandling.h"
+#include "Network/Components.h"
+#include "Parallel/ThreadPool.h"
+#include "Sweep/Sweep.h"
+#include "Training/BatchPipeline.h"
+#include "Training/DataParallelTrainer.h"
+#include "Training/HogwildTrainer.h"
+
+// Hyperparameter sweep runner. Expands a sweep file (see Sweep::expand) into a grid of configs, maps the training
+// and test sets once and trains one independent network per config, several at a time, all reading the same
+// read-only mappings. Prints a results table with test accuracy, final training loss and wall time per config and
+// optionally writes it as CSV. Checkpoints, metrics and prediction logs of the configs are not written.
+
+namespace {
+    struct Options {
+        std::string sweepPath;
+        std::string resultsPath;
+        int jobs = static_cast<int>(std::max(1U, std::thread::hardware_concurrency()));
+    };
+
+    struct Result {
+        double accuracy = 0;
+        double loss = 0;
+        double seconds = 0;
+        double samplesPerSecond = 0;
+    };
+
+    template<typename T, typename Master>
+    double accuracy(const Network<T, Master>& network, const MNISTLoader<T>& loader, int chunkSize) {
+        auto workspace = network.makeWorkspace(chunkSize);
+        Buffer<T> chunk;
+        chunk.reserve(static_cast<Eigen::Index>(chunkSize) * loader.imageSize());
+        int correct = 0;
+        for (int i = 0; i < loader.imageCount(); i += chunkSize) {
+            const int count = std::min(chunkSize, loader.imageCount() - i);
+            auto images = chunk.view(count, loader.imageSize());
+            loader.copyImageBatch(i, count, images);
+            const auto logits = network.forward(images, workspace);
+            for (int j = 0; j < count; ++j) {
+                Eigen::Index prediction;
+                logits.row(j).maxCoeff(&prediction);
+                correct += static_cast<int>(prediction) == loader.rawLabel(i + j);
+            }
+        }
+        return loader.imageCount() > 0 ? static_cast<double>(correct) / loader.imageCount() : 0.0;
+    }
+
+    // Trains and tests one config of the sweep; the loss is the mean training loss of the last epoch.
+    template<typename T, typename Master>
+    Result runPoint(const Utils::Config& config, const MNISTLoader<T>& trainLoader, const MNISTLoader<T>& testLoader) {
+        const auto start = std::chrono::steady_clock::now();
+        const auto learningRate = static_cast<Master>(config.learning_rate);
+        Network<T, Master> network;
+        network.setSeed(config.seed);
+        network.setOptimizer(config.optimizer);
+        network.setSparseInput(config.sparse_input);
+        network.addLayer(trainLoader.imageSize(), config.hidden_size, Activation::ReLU{});
+        network.addLayer(config.hidden_size, 10, Activation::Identity{});
+        network.reserve(config.batch_size);
+
+        Result result;
+        if (config.training_mode == "hogwild") {
+            HogwildTrainer<T, Master> trainer(network, config.num_threads, config.batch_size);
+            std::vector<int> order;
+            for (int epoch = 0; epoch < config.num_epochs; ++epoch) {
+                epochOrder(trainLoader.imageCount(), config.shuffle, config.seed, epoch, order);
+                result.loss = trainer.trainEpoch(trainLoader, order, learningRate, config.loss_interval);
+            }
+            result.samplesPerSecond = trainer.samplesPerSecond();
+        } else {
+            DataParallelTrainer<T, Master> trainer(network, config.num_threads, config.batch_size);
+            BatchPipeline<T> pipeline(trainLoader, config.batch_size, 0, config.num_epochs, config.prefetch_batches,
+                                      config.shuffle, config.seed);
+            for (int epoch = 0; epoch < config.num_epochs; ++epoch) {
+                double totalLoss = 0;
+                long long lossRows = 0;
+                for (int i = 0; i < pipeline.batchesPerEpoch(); ++i) {
+                    const auto& batch = pipeline.acquire();
+                    const bool computeLoss = i % config.loss_interval == 0;
+                    totalLoss += trainer.step(pipeline.images(batch), pipeline.labels(batch), learningRate,
+                                              computeLoss);
+                    lossRows += computeLoss ? batch.rows : 0;
+                    pipeline.release();
+                }
+                result.loss = lossRows > 0 ? totalLoss / static_cast<double>(lossRows) : 0.0;
+            }
+            result.samplesPerSecond = trainer.samplesPerSecond();
+        }
+        result.accuracy = accuracy(network, testLoader, config.eval_batch_size);
+        result.seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        return result;
+    }
+
+    std::string fixed(double value, int digits) {
+        std::ostringstream text;
+        text << std::fixed << std::setprecision(digits) << value;
+        return text.str();
+    }
+
+    void report(const std::vector<Sweep::Point>& points, const std::vector<Result>& results, const Options& options) {
+        std::vector<std::string> header{"#"};
+        for (const auto& [key, value] : points.front().values) {
+            header.push_back(key);
+        }
+        for (const char* column : {"accuracy", "final_loss", "wall_s", "samples/s"}) {
+            header.emplace_back(column);
+        }
+
+        std::vector<std::vector<std::string>> rows;
+        for (std::size_t p = 0; p < points.size(); ++p) {
+            std::vector<std::string> row{std::to_string(p)};
+            for (const auto& [key, value] : points[p].values) {
+                row.push_back(value);
+            }
+            row.push_back(fixed(results[p].accuracy, 6));
+            row.push_back(fixed(results[p].loss, 6));
+            row.push_back(fixed(results[p].seconds, 3));
+            row.push_back(fixed(results[p].samplesPerSecond, 0));
+            rows.push_back(std::move(row));
+        }
+
+        std::vector<std::size_t> widths(header.size());
+        for (std::size_t c = 0; c < header.size(); ++c) {
+            widths[c] = header[c].size();
+            for (const auto& row : rows) {
+                widths[c] = std::max(widths[c], row[c].size());
+            }
+        }
+        auto print = [&](const std::vector<std::string>& row) {
+            for (std::size_t c = 0; c < row.size(); ++c) {
+                std::cout << (c > 0 ? "  " : "") << std::setw(static_cast<int>(widths[c])) << row[c];
+            }
+            std::cout << std::endl;
+        };
+        print(header);
+        for (const auto& row : rows) {
+            print(row);
+        }
+        const auto best = std::max_element(results.begin(), results.end(), [](const Result& a, const Result& b) {
+            return a.accuracy < b.accuracy;
+        });
+        std::cout << "Best: #" << (best - results.begin()) << std::endl;
+
+        if (!options.resultsPath.empty()) {
+            std::ofstream csv(options.resultsPath);
+            header.back() = "samples_per_s";
+            header.front() = "index";
+            for (std::size_t c = 0; c < header.size(); ++c) {
+                csv << (c > 0 ? "," : "") << header[c];
+            }
+            csv << '\n';
+            for (const auto& row : rows) {
+                for (std::size_t c = 0; c < row.size(); ++c) {
+                    csv << (c > 0 ? "," : "") << row[c];
+                }
+                csv << '\n';
+            }
+            if (!csv) {
+                std::cerr << "Error: Could not write " << options.resultsPath << std::endl;
+            }
+        }
+    }
+
+    template<typename T, typename Master = T>
+    int run(const std::vector<Sweep::Point>& points, const Options& options) {
+        std::cout << "Compute backend: " << Compute::backendName(Compute::gemmBackend<T>()) << std::endl;
+
+        // Every point reads the same mappings; the IDX files are mapped once for the whole sweep
+        const Utils::Config& shared = points.front().config;
+        MNISTLoader<T> trainLoader;
+        trainLoader.mapImages(shared.rel_path_train_images);
+        trainLoader.mapLabels(shared.rel_path_train_labels);
+        MNISTLoader<T> testLoader;
+        testLoader.mapImages(shared.rel_path_test_images);
+        testLoader.mapLabels(shared.rel_path_test_labels);
+
+        const int jobs = std::min(options.jobs, static_cast<int>(points.size()));
+        std::cout << "Running " << points.size() << " configs, " << jobs << " at a time..." << std::endl;
+        const auto start = std::chrono::steady_clock::now();
+        std::vector<Result> results(points.size());
+        std::atomic<std::size_t> next{0};
+        std::mutex output;
+        ThreadPool pool(jobs);
+        pool.run([&](int) {
+            for (std::size_t p; (p = next.fetch_add(1, std::memory_order_relaxed)) < points.size();) {
+                results[p] = runPoint<T, Master>(points[p].config, trainLoader, testLoader);
+                std::lock_guard lock(output);
+                std::cout << "Finished #" << p << " (" << std::fixed << std::setprecision(3) << results[p].seconds
+                          << " s)" << std::endl;
+            }
+        });
+        std::cout << "Sweep wall time: " << std::fixed << std::setprecision(3)
+                  << std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count() << " s"
+                  << std::endl;
+        report(points, results, options);
+        return 0;
+    }
+}
+
+int main(int argc, char *argv[]) {
+    Options options;
+    for (int i = 1; i < argc; ++i) {
+        const std::string argument = argv[i];
+        if (argument == "--jobs" && i + 1 < argc) {
+            options.jobs = std::stoi(argv[++i]);
+        } else if (argument == "--results" && i + 1 < argc) {
+            options.resultsPath = argv[++i];
+        } else if (options.sweepPath.empty() && argument.rfind("--", 0) != 0) {
+            options.sweepPath = argument;
+        } else {
+            options.sweepPath.clear();
+            break;
+        }
+    }
+    if (options.sweepPath.empty() || options.jobs < 1) {
+        std::cout << "Usage: " << argv[0] << " <sweep_file> [--jobs <n>] [--results <csv_path>]" << std::endl;
+        return 1;
+    }
+
+    const std::vector<Sweep::Point> points = Sweep::expand(options.sweepPath);
+    if (points.empty()) {
+        return 1;
+    }
+    for (const auto& point : points) {
+        if (point.config.world_size > 1) {
+            std::cerr << "Sweeps run in one process; world_size must be 1" << std::endl;
+            return 1;
+        }
+    }
+
+    try {
+        if (points.front().config.compute_backend != "auto") {
+            Compute::selectBackend(Compute::parseBackend(points.front().config.compute_backend));
+        }
+        const std::string& precision = points.front().config.precision;
+        if (precision == "float") {
+            return run<float>(points, options);
+        }
+        if (precision == "mixed") {
+            return run<float, double>(points, options);
+        }
+        return run<double>(points, options);
+    } catch (const std::exception& e) {
+        std::cerr << "Error: " << e.what() << std::endl;
+        return 1;
+    }
+}
@@ -0,0 +1,283 @@
+#ifndef PERCEPTRON_CHECKPOINT_H
+#define PERCEPTRON_CHECKPOINT_H
+
+#pragma once
+
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+#include "../DataHandling.h"
+#include "Components.h"
+
+// Binary checkpoints of a Network.
+//
+// Layout (all integers little-endian, every data block starts on a 64-byte boundary):
+//   FileHeader
+//   LayerRecord[layerCount]
+//   per layer: weights (inputSize x outputSize, column-major), biases (outputSize),
+//              then stateBlocks pairs of weight- and bias-shaped optimizer state
+//
+// Values are stored in the network's Master precision. Loading maps the file and copies every block straight
+// into the parameters, so no parsing is involved. The optimizer state is restored when the network is set up with
+// the optimizer that wrote it; otherwise the network's optimizer starts from fresh state. Files are written to a
+// temporary name and renamed, so a crash during a write never leaves a truncated checkpoint behind.
+namespace Checkpoint {
+    constexpr char magic[8] = {'P', 'C', 'P', 'T', 'C', 'K', 'P', 'T'};
+    constexpr std::uint32_t version = 1;
+    constexpr std::uint32_t byteOrderMark = 0x01020304;
+    constexpr std::size_t alignment = 64;
+
+    struct FileHeader {
+        char magic[8];
+        std::uint32_t version;
+        std::uint32_t byteOrder;
+        std::uint32_t scalarSize;  // 4 for float, 8 for double
+        std::uint32_t layerCount;
+        std::uint32_t optimizer;   // Optimizer identifier; 0 is plain SGD without state
+        std::uint32_t reserved0;
+        std::uint64_t epoch;       // Completed training epochs
+        std::uint64_t optimizerStep;
+        std::uint64_t reserved[2];
+    };
+    static_assert(sizeof(FileHeader) == 64);
+
+    struct LayerRecord {
+        std::uint32_t inputSize;
+        std::uint32_t outputSize;
+        std::uint32_t activation;  // Network::activationIndex
+        std::uint32_t stateBlocks;
+        std::uint64_t weightsOffset;
+        std::uint64_t biasesOffset;
+        std::uint64_t stateOffset;
+        std::uint64_t reserved;
+    };
+    static_assert(sizeof(LayerRecord) == 48);
+
+    // Training progress stored alongside the parameters.
+    struct State {
+        std::uint64_t epoch = 0;
+        std::uint32_t optimizer = 0;
+        std::uint64_t optimizerStep = 0;
+    };
+
+    inline std::uint64_t alignUp(std::uint64_t offset) {
+        return (offset + alignment - 1) / alignment * alignment;
+    }
+
+    // Writes the parameters and optimizer state of network, recording epoch completed training epochs.
+    template<typename T, typename Master>
+    void save(const Network<T, Master> &network, const std::string &path, std::uint64_t epoch) {
+        const auto blocks = static_cast<std::uint32_t>(Optimizer::stateBlocks(network.optimizer().kind));
+        std::vector<LayerRecord> records(network.layerCount());
+        std::uint64_t offset = alignUp(sizeof(FileHeader) + records.size() * sizeof(LayerRecord));
+        for (std::size_t l = 0; l < network.layerCount(); ++l) {
+            const auto &layer = network.layer(l);
+            if (network.activationIndex(l) > 1) {
+                throw std::runtime_error("Cannot checkpoint a layer with a custom activation function");
+            }
+            LayerRecord &record = records[l];
+            record = {};
+            record.inputSize = static_cast<std::uint32_t>(layer.inputSize());
+            record.outputSize = static_cast<std::uint32_t>(layer.outputSize());
+            record.activation = static_cast<std::uint32_t>(network.activationIndex(l));
+            record.weightsOffset = offset;
+            offset = alignUp(offset + layer.parameterWeights().size() * sizeof(Master));
+            record.biasesOffset = offset;
+            offset = alignUp(offset + layer.parameterBiases().size() * sizeof(Master));
+            record.stateOffset = offset;
+            record.stateBlocks = blocks;
+            for (std::uint32_t b = 0; b < blocks; ++b) {
+                offset = alignUp(offset + layer.parameterWeights().size() * sizeof(Master));
+                offset = alignUp(offset + layer.parameterBiases().size() * sizeof(Master));
+            }
+        }
+
+        FileHeader header{};
+        std::memcpy(header.magic, magic, sizeof(magic));
+        header.version = version;
+        header.byteOrder = byteOrderMark;
+        header.scalarSize = sizeof(Master);
+        header.layerCount = static_cast<std::uint32_t>(records.size());
+        header.optimizer = static_cast<std::uint32_t>(network.optimizer().kind);
+        header.epoch = epoch;
+        header.optimizerStep = network.optimizerStep();
+
+        const std::string temporaryPath = path + ".tmp";
+        {
+            std::ofstream file(temporaryPath, std::ios::binary | std::ios::trunc);
+            if (!file) {
+                throw std::runtime_error("Cannot create checkpoint: " + temporaryPath);
+            }
+            auto writeAt = [&](std::uint64_t position, const void *data, std::size_t bytes) {
+                static constexpr char zeros[alignment] = {};
+                const auto current = static_cast<std::uint64_t>(file.tellp());
+                file.write(zeros, static_cast<std::streamsize>(position - current));
+                file.write(static_cast<const char *>(data), static_cast<std::streamsize>(bytes));
+            };
+            writeAt(0, &header, sizeof(header));
+            writeAt(sizeof(header), records.data(), records.size() * sizeof(LayerRecord));
+            for (std::size_t l = 0; l < network.layerCount(); ++l) {
+                const auto &layer = network.layer(l);
+                writeAt(records[l].weightsOffset, layer.parameterWeights().data(),
+                        layer.parameterWeights().size() * sizeof(Master));
+                writeAt(records[l].biasesOffset, layer.parameterBiases().data(),
+                        layer.parameterBiases().size() * sizeof(Master));
+                std::uint64_t position = records[l].stateOffset;
+                for (std::uint32_t b = 0; b < blocks; ++b) {
+                    const auto &weights = layer.optimizer().weights[b];
+                    const auto &biases = layer.optimizer().biases[b];
+                    writeAt(position, weights.data(), weights.size() * sizeof(Master));
+                    position = alignUp(position + weights.size() * sizeof(Master));
+                    writeAt(position, biases.data(), biases.size() * sizeof(Master));
+                    position = alignUp(position + biases.size() * sizeof(Master));
+                }
+            }
+            if (!file.flush()) {
+                throw std::runtime_error("Failed to write checkpoint: " + temporaryPath);
+            }
+        }
+        if (std::rename(temporaryPath.c_str(), path.c_str()) != 0) {
+            throw std::runtime_error("Cannot replace checkpoint: " + path);
+        }
+    }
+
+    namespace detail {
+        template<typename Stored, typename T, typename Master>
+        void loadLayer(Layer<T, Master> &layer, const unsigned char *base, const LayerRecord &record) {
+            const Eigen::Map<const MatrixT<Stored>> weights(reinterpret_cast<const Stored *>(base + record.weightsOffset),
+                                                            record.inputSize, record.outputSize);
+            const Eigen::Map<const VectorT<Stored>> biases(reinterpret_cast<const Stored *>(base + record.biasesOffset),
+                                                           record.outputSize);
+            if constexpr (std::is_same_v<Stored, Master>) {
+                layer.setParameters(weights, biases);
+            } else {
+                layer.setParameters(weights.template cast<Master>(), biases.template cast<Master>());
+            }
+        }
+
+        template<typename Stored, typename T, typename Master>
+        void loadOptimizerState(Layer<T, Master> &layer, const unsigned char *base, const LayerRecord &record) {
+            auto &state = layer.optimizer();
+            std::uint64_t position = record.stateOffset;
+            for (std::uint32_t b = 0; b < record.stateBlocks; ++b) {
+                state.weights[b] = Eigen::Map<const MatrixT<Stored>>(reinterpret_cast<const Stored *>(base + position),
+                                                                     record.inputSize, record.outputSize)
+                        .template cast<Master>();
+                position = alignUp(position + std::uint64_t{record.inputSize} * record.outputSize * sizeof(Stored));
+                state.biases[b] = Eigen::Map<const VectorT<Stored>>(reinterpret_cast<const Stored *>(base + position),
+                                                                    record.outputSize)
+                        .template cast<Master>();
+                position = alignUp(position + std::uint64_t{record.outputSize} * sizeof(Stored));
+            }
+        }
+
+        // Whether the block [offset, offset + count * scalarSize) is scalar-aligned and lies inside the file
+        inline bool blockInFile(std::uint64_t offset, std::uint64_t count, std::uint32_t scalarSize,
+                                std::uint64_t fileSize) {
+            return offset % scalarSize == 0 && offset <= fileSize && count <= (fileSize - offset) / scalarSize;
+        }
+
+        // Whether every data block of a layer record lies inside the file and can be read as scalarSize values
+        inline bool recordInFile(const LayerRecord &record, std::uint32_t scalarSize, std::uint64_t fileSize) {
+            if (record.inputSize == 0 || record.outputSize == 0) {
+                return false;
+            }
+            const std::uint64_t weightCount = std::uint64_t{record.inputSize} * record.outputSize;
+            if (!blockInFile(record.weightsOffset, weightCount, scalarSize, fileSize) ||
+                !blockInFile(record.biasesOffset, record.outputSize, scalarSize, fileSize)) {
+                return false;
+            }
+            std::uint64_t position = record.stateOffset;
+            for (std::uint32_t b = 0; b < record.stateBlocks; ++b) {
+                if (!blockInFile(position, weightCount, scalarSize, fileSize)) {
+                    return false;
+                }
+                position = alignUp(position + weightCount * scalarSize);
+                if (!blockInFile(position, record.outputSize, scalarSize, fileSize)) {
+                    return false;
+                }
+                position = alignUp(position + std::uint64_t{record.outputSize} * scalarSize);
+            }
+            return true;
+        }
+    }
+
+    // Loads the parameters of a checkpoint into network. An empty network is built from the stored topology;
+    // otherwise the topology has to match. Returns the stored training progress.
+    template<typename T, typename Master>
+    State load(Network<T, Master> &network, const std::string &path) {
+        const MappedFile file(path);
+        if (file.size() < sizeof(FileHeader)) {
+            throw std::runtime_error("Not a checkpoint: " + path);
+        }
+        FileHeader header;
+        std::memcpy(&header, file.data(), sizeof(header));
+        if (std::memcmp(header.magic, magic, sizeof(magic)) != 0) {
+            throw std::runtime_error("Not a checkpoint: " + path);
+        }
+        if (header.version != version || header.byteOrder != byteOrderMark) {
+            throw std::runtime_error("Unsupported checkpoint version or byte order: " + path);
+        }
+        if (header.scalarSize != sizeof(float) && header.scalarSize != sizeof(double)) {
+            throw std::runtime_error("Unsupported checkpoint precision: " + path);
+        }
+        if (header.layerCount == 0) {
+            throw std::runtime_error("Checkpoint without layers: " + path);
+        }
+        if (file.size() < sizeof(FileHeader) + header.layerCount * sizeof(LayerRecord)) {
+            throw std::runtime_error("Truncated checkpoint: " + path);
+        }
+
+        std::vector<LayerRecord> records(header.layerCount);
+        std::memcpy(records.data(), file.data() + sizeof(FileHeader), records.size() * sizeof(LayerRecord));
+        const bool build = network.layerCount() == 0;
+        if (!build && network.layerCount() != records.size()) {
+            throw std::runtime_error("Checkpoint topology does not match the network: " + path);
+        }
+        const auto kind = network.optimizer().kind;
+        bool restoreOptimizer = header.optimizer == static_cast<std::uint32_t>(kind);
+        for (const LayerRecord &record : records) {
+            restoreOptimizer = restoreOptimizer &&
+                               record.stateBlocks == static_cast<std::uint32_t>(Optimizer::stateBlocks(kind));
+        }
+        for (std::size_t l = 0; l < records.size(); ++l) {
+            const LayerRecord &record = records[l];
+            if (!detail::recordInFile(record, header.scalarSize, file.size()) || record.activation > 1 ||
+                (l > 0 && record.inputSize != records[l - 1].outputSize)) {
+                throw std::runtime_error("Corrupt checkpoint: " + path);
+            }
+            if (build) {
+                if (record.activation == 0) {
+                    network.addLayer(record.inputSize, record.outputSize, Activation::ReLU{});
+                } else {
+                    network.addLayer(record.inputSize, record.outputSize, Activation::Identity{});
+                }
+            } else if (network.layer(l).inputSize() != record.inputSize ||
+                       network.layer(l).outputSize() != record.outputSize ||
+                       network.activationIndex(l) != record.activation) {
+                throw std::runtime_error("Checkpoint topology does not match the network: " + path);
+            }
+            if (header.scalarSize == sizeof(float)) {
+                detail::loadLayer<float>(network.layer(l), file.data(), record);
+                if (restoreOptimizer) {
+                    detail::loadOptimizerState<float>(network.layer(l), file.data(), record);
+                }
+            } else {
+                detail::loadLayer<double>(network.layer(l), file.data(), record);
+                if (restoreOptimizer) {
+                    detail::loadOptimizerState<double>(network.layer(l), file.data(), record);
+                }
+            }
+        }
+        if (restoreOptimizer) {
+            network.setOptimizerStep(header.optimizerStep);
+        }
+        return {header.epoch, header.optimizer, header.optimizerStep};
+    }
+}
+
+#endif //PERCEPTRON_CHECKPOINT_H
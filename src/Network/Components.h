@@ -4,129 +4,685 @@
 #pragma once
 
 #include <Eigen/Dense>
+#include <algorithm>
+#include <atomic>
 #include <cmath>
-#include <cstdlib>
+#include <cstdint>
 #include <vector>
 #include <functional>
+#include <type_traits>
+#include <variant>
+#include "../Compute/Gemm.h"
+#include "../Metrics/Trace.h"
+#include "../Random/Rng.h"
+#include "Optimizer.h"
+#include "SparseInput.h"
 #include "Types.hpp"
+#include "Workspace.h"
 
+// Activation functions write f(x), or f'(x) for the derivatives, into out.
 namespace Activation {
-    inline Matrix relu(const Matrix &x) {
-        return x.cwiseMax(0);
+    template<typename T>
+    inline void relu(ConstMatrixRef<T> x, MatrixRef<T> out) {
+        out = x.cwiseMax(T(0));
     }
 
-    inline Matrix reluDerivative(const Matrix &x) {
-        return (x.array() > 0).cast<Precision>();
+    template<typename T>
+    inline void reluDerivative(ConstMatrixRef<T> x, MatrixRef<T> out) {
+        out = (x.array() > T(0)).template cast<T>();
     }
 
-    inline Matrix softmax(const Matrix &x) {
-        Matrix expX = x.array().exp();
+    // Row-wise softmax. The row max is subtracted before exponentiating so large logits cannot overflow.
+    template<typename T>
+    inline MatrixT<T> softmax(const MatrixT<T> &x) {
+        MatrixT<T> expX = (x.colwise() - x.rowwise().maxCoeff()).array().exp();
         return expX.array().colwise() / expX.rowwise().sum().array();
     }
 
+    template<typename T>
+    inline void softmax(ConstMatrixRef<T> x, MatrixRef<T> out) {
+        for (Eigen::Index i = 0; i < out.rows(); ++i) {
+            out.row(i) = (x.row(i).array() - x.row(i).maxCoeff()).exp();
+            out.row(i) /= out.row(i).sum();
+        }
+    }
+
     // Identity activation for output layer
-    inline Matrix identity(const Matrix &x) {
-        return x;
+    template<typename T>
+    inline void identity(ConstMatrixRef<T> x, MatrixRef<T> out) {
+        out = x;
     }
 
-    inline Matrix identityDerivative(const Matrix &x) {
-        return Matrix::Ones(x.rows(), x.cols());
+    template<typename T>
+    inline void identityDerivative(ConstMatrixRef<T> x, MatrixRef<T> out) {
+        out.setOnes();
     }
+
+    // Compile-time activation descriptions used by the fused layer kernels. apply() is inlined into the
+    // bias epilogue of the forward GEMM; backward() masks the incoming gradient in place using only the
+    // activated output, so the pre-activation values never need to be stored.
+    struct ReLU {
+        static constexpr bool isIdentity = false;
+
+        template<typename T>
+        static T apply(T x) {
+            return x > T(0) ? x : T(0);
+        }
+
+        // relu(x) > 0 exactly when x > 0, so the output carries the derivative mask.
+        template<typename T>
+        static void backward(ConstMatrixRef<T> output, MatrixRef<T> grad) {
+            grad = (output.array() > T(0)).select(grad, T(0));
+        }
+    };
+
+    struct Identity {
+        static constexpr bool isIdentity = true;
+
+        template<typename T>
+        static T apply(T x) {
+            return x;
+        }
+
+        template<typename T>
+        static void backward(ConstMatrixRef<T>, MatrixRef<T>) {}
+    };
 }
 
 namespace Loss {
-    inline Matrix crossEntropyDerivative(const Matrix &predictions, const Matrix &targets) {
+    template<typename T>
+    inline MatrixT<T> crossEntropyDerivative(const MatrixT<T> &predictions, const MatrixT<T> &targets) {
         return (-targets).cwiseQuotient(predictions);
     }
 
-    inline Vector crossEntropy(const Matrix &predictions, const Matrix &targets) {
-        return -(targets.array() * (predictions.array() + 1e-8).log()).rowwise().sum();
+    template<typename T>
+    inline VectorT<T> crossEntropy(const MatrixT<T> &predictions, const MatrixT<T> &targets) {
+        return -(targets.array() * (predictions.array() + T(1e-8)).log()).rowwise().sum();
+    }
+
+    template<typename T>
+    inline void crossEntropy(ConstMatrixRef<T> predictions, ConstMatrixRef<T> targets, VectorRef<T> out) {
+        out = -(targets.array() * (predictions.array() + T(1e-8)).log()).rowwise().sum();
     }
 
-    inline Matrix softmaxCrossEntropyDerivative(const Matrix &logits, const Matrix &targets) {
-        Matrix softmax_output = Activation::softmax(logits);
+    template<typename T>
+    inline MatrixT<T> softmaxCrossEntropyDerivative(const MatrixT<T> &logits, const MatrixT<T> &targets) {
+        MatrixT<T> softmax_output = Activation::softmax(logits);
         return softmax_output - targets;
     }
+
+    // Same as above, given softmax(logits) that the caller already computed for the loss.
+    template<typename T>
+    inline void softmaxCrossEntropyDerivative(ConstMatrixRef<T> softmaxOutput, ConstMatrixRef<T> targets,
+                                              MatrixRef<T> out) {
+        out = softmaxOutput - targets;
+    }
+
+    // Kernel of the fused softmax cross-entropy below. Rows are processed in blocks small enough for the row max
+    // and sum to live on the stack; matrices are column-major, so every column step vectorizes across the rows of
+    // a block.
+    template<typename T, bool ComputeLoss>
+    inline void softmaxCrossEntropyKernel(ConstMatrixRef<T> logits, ConstMatrixRef<T> targets,
+                                          MatrixRef<T> gradient, T *loss) {
+        constexpr Eigen::Index blockRows = 32;
+        using Column = Eigen::Array<T, Eigen::Dynamic, 1, Eigen::ColMajor, blockRows, 1>;
+        const Eigen::Index classes = logits.cols();
+        for (Eigen::Index first = 0; first < logits.rows(); first += blockRows) {
+            const Eigen::Index rows = std::min(blockRows, logits.rows() - first);
+            const auto z = logits.middleRows(first, rows).array();
+            const auto t = targets.middleRows(first, rows).array();
+            auto g = gradient.middleRows(first, rows).array();
+
+            Column rowMax = z.col(0);
+            for (Eigen::Index c = 1; c < classes; ++c) {
+                rowMax = rowMax.max(z.col(c));
+            }
+            Column sum = Column::Zero(rows);
+            for (Eigen::Index c = 0; c < classes; ++c) {
+                g.col(c) = (z.col(c) - rowMax).exp();
+                sum += g.col(c);
+            }
+            const Column inverse = sum.inverse();
+            for (Eigen::Index c = 0; c < classes; ++c) {
+                g.col(c) = g.col(c) * inverse - t.col(c);
+            }
+
+            if constexpr (ComputeLoss) {
+                // -sum_c t_c log(p_c) with log(p_c) = z_c - max - log(sum)
+                const Column logSum = sum.log();
+                Column rowLoss = Column::Zero(rows);
+                for (Eigen::Index c = 0; c < classes; ++c) {
+                    rowLoss += t.col(c) * (logSum - (z.col(c) - rowMax));
+                }
+                Eigen::Map<Column>(loss + first, rows) = rowLoss;
+            }
+        }
+    }
+
+    // Fused softmax and cross-entropy on raw logits: writes softmax(logits) - targets, the gradient of the summed
+    // loss with respect to the logits, into gradient and the loss of every row into loss. Computes the softmax
+    // once and uses log-sum-exp for the loss, so it is safe in float.
+    template<typename T>
+    inline void softmaxCrossEntropy(ConstMatrixRef<T> logits, ConstMatrixRef<T> targets, MatrixRef<T> gradient,
+                                    VectorRef<T> loss) {
+        softmaxCrossEntropyKernel<T, true>(logits, targets, gradient, loss.data());
+    }
+
+    // Same as above for batches whose loss is not needed.
+    template<typename T>
+    inline void softmaxCrossEntropy(ConstMatrixRef<T> logits, ConstMatrixRef<T> targets, MatrixRef<T> gradient) {
+        softmaxCrossEntropyKernel<T, false>(logits, targets, gradient, nullptr);
+    }
 }
 
+// T is the compute precision used for activations and GEMMs. Master is the precision of the weights
+// that receive the updates; when it differs from T (mixed precision), the layer keeps a master copy
+// and refreshes the compute copy after every update.
+// A layer only holds parameters; everything produced by a pass over a batch (activations, gradients)
+// lives in the caller's Network::Workspace, so several threads can run passes against one layer.
+template<typename T, typename Master = T>
 class Layer {
 public:
-    Layer(int inputSize, int outputSize) {
-        constexpr int seed = 23405559;
-        std::srand(seed);
-        // Xavier initialization
-        weights = Matrix::Random(inputSize, outputSize) * std::sqrt(2.0 / inputSize);
-        biases = Vector::Zero(outputSize);
-        gradWeights = Matrix::Zero(inputSize, outputSize);
-        gradBiases = Vector::Zero(outputSize);
+    // Parameter gradients summed over a batch
+    struct Gradients {
+        MatrixT<T> weights;
+        VectorT<T> biases;
+    };
+
+    // Optimizer buffers shaped like the parameters, one pair per Optimizer::stateBlocks
+    struct OptimizerState {
+        std::vector<MatrixT<Master>> weights;
+        std::vector<VectorT<Master>> biases;
+    };
+
+    // Weights are drawn uniformly from [-sqrt(2 / inputSize), sqrt(2 / inputSize)) out of stream, biases start at 0.
+    // There is no default stream: layers sharing one would start with identical weights, so Network passes the
+    // split of its initialization stream for the layer index.
+    Layer(int inputSize, int outputSize, const Rng::Stream &stream) {
+        MatrixT<Master> initialWeights(inputSize, outputSize);
+        Rng::fillSymmetric(initialWeights, stream, static_cast<Master>(std::sqrt(2.0 / inputSize)));
+        weights = initialWeights.template cast<T>();
+        biases = VectorT<T>::Zero(outputSize);
+        if constexpr (hasMasterCopy) {
+            masterWeights = std::move(initialWeights);
+            masterBiases = VectorT<Master>::Zero(outputSize);
+        }
+    }
+
+    // Writes Act(input * weights + biases) into output; bias add and activation are fused into a single pass
+    // after the GEMM.
+    template<typename Act = Activation::Identity>
+    void forward(ConstMatrixRef<T> input, MatrixRef<T> output) const {
+        TRACE_SCOPE("layer_forward");
+        Compute::multiply<T>(input, false, weights, false, output);
+        if constexpr (Act::isIdentity) {
+            output.rowwise() += biases.transpose();
+        } else {
+            output = (output.rowwise() + biases.transpose()).unaryExpr([](T x) { return Act::template apply<T>(x); });
+        }
+    }
+
+    // Computes the weight and bias gradients only; used for the first layer, whose input gradient is unused.
+    void backward(ConstMatrixRef<T> input, ConstMatrixRef<T> gradOutput, Gradients &gradients) const {
+        TRACE_SCOPE("layer_backward");
+        Compute::multiply<T>(input, true, gradOutput, false, gradients.weights);
+        gradients.biases = gradOutput.colwise().sum();
+    }
+
+    // Sparse-input forward; requires weightsByInputCurrent().
+    template<typename Act = Activation::Identity>
+    void forward(const SparseInput::CsrBatch<T> &input, MatrixRef<T> output) const {
+        TRACE_SCOPE("layer_forward_sparse");
+        SparseInput::forward<Act>(input, weightsByInput, biases, output);
     }
 
-    Matrix forward(const Matrix &input) {
-        inputCache = input;
-        return (input * weights).rowwise() + biases.transpose();
+    // Sparse-input variant of the gradient-only backward; gradientByInput and rowGradient are scratch space.
+    void backward(const SparseInput::CsrBatch<T> &input, ConstMatrixRef<T> gradOutput, Gradients &gradients,
+                  MatrixT<T> &gradientByInput, VectorT<T> &rowGradient) const {
+        TRACE_SCOPE("layer_backward_sparse");
+        SparseInput::weightGradient(input, gradOutput, gradientByInput, rowGradient);
+        gradients.weights = gradientByInput.transpose();
+        gradients.biases = gradOutput.colwise().sum();
     }
 
-    Matrix backward(const Matrix &gradOutput) {
-        gradWeights = inputCache.transpose() * gradOutput;
-        gradBiases = gradOutput.colwise().sum() / (std::max(static_cast<int>(gradOutput.rows() - 1), 1));
-        return gradOutput * weights.transpose();
+    // Keeps a transposed copy of the weights for the sparse-input kernels. Updates refresh it on request only,
+    // since the transpose costs about as much as a small batch.
+    void keepWeightsByInput(bool keep) {
+        if (keep) {
+            weightsByInput = weights.transpose();
+        } else {
+            weightsByInput.resize(0, 0);
+        }
+        std::atomic_ref<bool>(byInputCurrent).store(keep, std::memory_order_release);
+    }
+
+    // Whether the transposed copy matches the weights.
+    [[nodiscard]] bool weightsByInputCurrent() const {
+        return std::atomic_ref<bool>(const_cast<bool &>(byInputCurrent)).load(std::memory_order_acquire);
+    }
+
+    // Computes the parameter gradients and writes the gradient with respect to the input into gradInput.
+    void backward(ConstMatrixRef<T> input, ConstMatrixRef<T> gradOutput, Gradients &gradients,
+                  MatrixRef<T> gradInput) const {
+        backward(input, gradOutput, gradients);
+        TRACE_SCOPE("input_gradient");
+        Compute::multiply<T>(gradOutput, false, weights, true, gradInput);
+    }
+
+    // Plain SGD step
+    void updateWeights(Master learningRate, const Gradients &gradients) {
+        updateWeights(Optimizer::Step<Master>(Optimizer::Settings{}, learningRate, 1), gradients);
+    }
+
+    // Applies one optimizer step in a single fused pass per parameter array. The optimizer state must have been
+    // sized for step.kind with resetOptimizerState(). A kept transposed copy of the weights is refreshed if
+    // refreshWeightsByInput is set and goes stale otherwise.
+    void updateWeights(const Optimizer::Step<Master> &step, const Gradients &gradients,
+                       bool refreshWeightsByInput = true) {
+        auto stateData = [](auto &blocks, int index) {
+            return index < static_cast<int>(blocks.size()) ? blocks[index].data() : nullptr;
+        };
+        Master *parameters[2];
+        T *copies[2];
+        if constexpr (hasMasterCopy) {
+            parameters[0] = masterWeights.data();
+            parameters[1] = masterBiases.data();
+            copies[0] = weights.data();
+            copies[1] = biases.data();
+        } else {
+            parameters[0] = weights.data();
+            parameters[1] = biases.data();
+            copies[0] = nullptr;
+            copies[1] = nullptr;
+        }
+        Optimizer::update(step, parameters[0], gradients.weights.data(), stateData(optimizerState.weights, 0),
+                          stateData(optimizerState.weights, 1), copies[0], weights.size(), true);
+        Optimizer::update(step, parameters[1], gradients.biases.data(), stateData(optimizerState.biases, 0),
+                          stateData(optimizerState.biases, 1), copies[1], biases.size(), false);
+        if (weightsByInput.size() > 0) {
+            if (refreshWeightsByInput) {
+                weightsByInput = weights.transpose();
+            }
+            std::atomic_ref<bool>(byInputCurrent).store(refreshWeightsByInput, std::memory_order_release);
+        }
+    }
+
+    // Zeroed optimizer buffers for the given number of state blocks.
+    void resetOptimizerState(int blocks) {
+        optimizerState.weights.assign(blocks, MatrixT<Master>::Zero(inputSize(), outputSize()));
+        optimizerState.biases.assign(blocks, VectorT<Master>::Zero(outputSize()));
+    }
+
+    [[nodiscard]] OptimizerState &optimizer() { return optimizerState; }
+    [[nodiscard]] const OptimizerState &optimizer() const { return optimizerState; }
+
+    // Parameters in Master precision; these are what checkpoints store.
+    [[nodiscard]] const MatrixT<Master> &parameterWeights() const {
+        if constexpr (hasMasterCopy) {
+            return masterWeights;
+        } else {
+            return weights;
+        }
+    }
+
+    [[nodiscard]] const VectorT<Master> &parameterBiases() const {
+        if constexpr (hasMasterCopy) {
+            return masterBiases;
+        } else {
+            return biases;
+        }
+    }
+
+    void setParameters(const Eigen::Ref<const MatrixT<Master>> &newWeights,
+                       const Eigen::Ref<const VectorT<Master>> &newBiases) {
+        if constexpr (hasMasterCopy) {
+            masterWeights = newWeights;
+            masterBiases = newBiases;
+        }
+        weights = newWeights.template cast<T>();
+        biases = newBiases.template cast<T>();
+        if (weightsByInput.size() > 0) {
+            keepWeightsByInput(true);
+        }
     }
 
-    void updateWeights(Precision learningRate) {
-        weights -= learningRate * gradWeights;
-        biases -= learningRate * gradBiases;
+    [[nodiscard]] Gradients makeGradients() const {
+        return {MatrixT<T>::Zero(inputSize(), outputSize()), VectorT<T>::Zero(outputSize())};
     }
 
+    [[nodiscard]] Eigen::Index inputSize() const { return weights.rows(); }
+    [[nodiscard]] Eigen::Index outputSize() const { return weights.cols(); }
+
 private:
-    Matrix weights, gradWeights;
-    Vector biases, gradBiases;
-    Matrix inputCache;
+    static constexpr bool hasMasterCopy = !std::is_same_v<T, Master>;
+
+    MatrixT<T> weights;
+    VectorT<T> biases;
+    MatrixT<Master> masterWeights;
+    VectorT<Master> masterBiases;
+    OptimizerState optimizerState;
+    MatrixT<T> weightsByInput; // Transposed weights; empty unless kept for sparse inputs
+    bool byInputCurrent = false;
 };
 
+// The network owns the parameters; activations and gradients of a pass live in a Workspace. The network
+// keeps a default workspace for single-threaded use, and makeWorkspace() creates independent ones, e.g. one
+// per worker thread. Once reserve() has sized a workspace for the largest batch, a training step performs no
+// heap allocations. Layers with a compile-time activation (Activation::ReLU, Activation::Identity) run the
+// fused kernels; arbitrary activation functions are still accepted and take the slower unfused path.
+template<typename T, typename Master = T>
 class Network {
 public:
-    void addLayer(int inputSize, int outputSize,
-                  std::function<Matrix(const Matrix&)> activation,
-                  std::function<Matrix(const Matrix&)> activationDerivative) {
-        layers.emplace_back(Layer(inputSize, outputSize), activation, activationDerivative);
+    using ActivationFunction = std::function<void(ConstMatrixRef<T>, MatrixRef<T>)>;
+    using ConstView = typename Buffer<T>::ConstView;
+    using Gradients = typename Layer<T, Master>::Gradients;
+
+    class Workspace {
+    public:
+        [[nodiscard]] Gradients &gradients(std::size_t layer) { return layers[layer].gradients; }
+        [[nodiscard]] const Gradients &gradients(std::size_t layer) const { return layers[layer].gradients; }
+
+        // Whether the last forward pass took the sparse first-layer path
+        [[nodiscard]] bool usedSparseInput() const { return sparseInput; }
+
+        // Number of buffer (re)allocations so far; constant once the buffers fit the largest batch.
+        [[nodiscard]] std::size_t allocations() const {
+            std::size_t count = derivative.allocations() + csr.allocations();
+            for (const auto &layer : layers) {
+                count += layer.preActivation.allocations() + layer.output.allocations() + layer.delta.allocations();
+            }
+            return count;
+        }
+
+    private:
+        friend class Network;
+        using InputMap = Eigen::Map<const MatrixT<T>, 0, Eigen::OuterStride<>>;
+
+        struct LayerState {
+            Buffer<T> output;        // Stores layer output after activation
+            Buffer<T> delta;         // Gradient with respect to the layer output
+            Buffer<T> preActivation; // Stores layer output before activation (custom activations only)
+            Gradients gradients;
+        };
+        std::vector<LayerState> layers;
+        Buffer<T> derivative; // Scratch space for custom activation derivatives
+        // Sparse first-layer path: CSR copy of the last forward input and backward scratch space
+        SparseInput::CsrBatch<T> csr;
+        MatrixT<T> gradientByInput;
+        VectorT<T> rowGradient;
+        bool sparseInput = false;
+        // View of the last forward input
+        const T *inputData = nullptr;
+        Eigen::Index inputRows = 0;
+        Eigen::Index inputStride = 0;
+    };
+
+    template<typename Act>
+    void addLayer(int inputSize, int outputSize, Act activation) {
+        layers.push_back({Layer<T, Master>(inputSize, outputSize, initialization.split(layers.size())), activation});
+        layers.back().layer.resetOptimizerState(Optimizer::stateBlocks(optimizerSettings.kind));
+        if (layers.size() == 1) {
+            layers.front().layer.keepWeightsByInput(sparseSettings.mode != SparseInput::Mode::Off);
+        }
+        workspace.layers.push_back({{}, {}, {}, layers.back().layer.makeGradients()});
+    }
+
+    // Seeds the initial weights of layers added afterwards. Every layer draws from its own stream, so networks built
+    // from the same seed are identical, whichever thread builds them.
+    void setSeed(std::uint64_t seed) {
+        initialization = Rng::Stream(seed).split(Rng::Purpose::Initialization);
     }
 
-    Matrix forward(const Matrix &input) {
-        Matrix current = input;
+    // Selects the update rule of updateWeights() and starts it from fresh state.
+    void setOptimizer(const Optimizer::Settings &settings) {
+        optimizerSettings = settings;
+        optimizerSteps = 0;
         for (auto &layer : layers) {
-            layer.preActivation = layer.layer.forward(current);
-            layer.postActivation = layer.activation(layer.preActivation);
-            current = layer.postActivation;
+            layer.layer.resetOptimizerState(Optimizer::stateBlocks(settings.kind));
+        }
+    }
+
+    [[nodiscard]] const Optimizer::Settings &optimizer() const { return optimizerSettings; }
+
+    // Selects when the first layer runs on a sparse copy of its input. Workspaces created before the first
+    // layer existed or while the mode was Off must be reserved again.
+    void setSparseInput(const SparseInput::Settings &settings) {
+        sparseSettings = settings;
+        if (!layers.empty()) {
+            layers.front().layer.keepWeightsByInput(settings.mode != SparseInput::Mode::Off);
+            reserve(workspace, reservedRows);
+        }
+    }
+
+    [[nodiscard]] const SparseInput::Settings &sparseInput() const { return sparseSettings; }
+
+    // Number of updates applied with the current optimizer; drives the Adam bias correction.
+    [[nodiscard]] std::uint64_t optimizerStep() const { return optimizerSteps; }
+
+    void setOptimizerStep(std::uint64_t step) { optimizerSteps = step; }
+
+    // Keeps the per-sample step size of the configured batch size when training runs with another one (e.g. one
+    // picked by the autotuner). Weight gradients are summed over the batch, so every sample moves the weights by
+    // the same amount whatever the batch size; bias gradients are averaged, so they are rescaled to the average
+    // over a batch of configuredBatch rows.
+    void setBatchSizeCompensation(int configuredBatch, int batch) {
+        biasBatchScale = T(std::max(configuredBatch - 1, 1)) / T(std::max(batch - 1, 1));
+    }
+
+    // The built-in activation functions are recognized and mapped onto their fused kernels.
+    void addLayer(int inputSize, int outputSize,
+                  ActivationFunction activation,
+                  ActivationFunction activationDerivative) {
+        if (holds(activation, Activation::relu<T>) && holds(activationDerivative, Activation::reluDerivative<T>)) {
+            addLayer(inputSize, outputSize, Activation::ReLU{});
+        } else if (holds(activation, Activation::identity<T>) &&
+                   holds(activationDerivative, Activation::identityDerivative<T>)) {
+            addLayer(inputSize, outputSize, Activation::Identity{});
+        } else {
+            addLayer(inputSize, outputSize, CustomActivation{std::move(activation), std::move(activationDerivative)});
+        }
+    }
+
+    // Creates a workspace for the current layers, sized for batches of up to batchSize rows.
+    [[nodiscard]] Workspace makeWorkspace(int batchSize) const {
+        Workspace result;
+        for (const auto &layer : layers) {
+            result.layers.push_back({{}, {}, {}, layer.layer.makeGradients()});
         }
-        return current; // Output is logits (last layer uses identity)
+        reserve(result, batchSize);
+        return result;
     }
 
-    void backward(const Matrix &gradOutput) {
-        Matrix grad = gradOutput;
-        for (auto it = layers.rbegin(); it != layers.rend(); ++it) {
-            // Apply activation derivative
-            Matrix activationGrad = it->activationDerivative(it->preActivation);
-            grad = grad.cwiseProduct(activationGrad);
+    // Sizes all intermediate buffers for batches of up to batchSize rows.
+    void reserve(int batchSize) {
+        reservedRows = std::max(reservedRows, batchSize);
+        reserve(workspace, batchSize);
+    }
+
+    void reserve(Workspace &ws, int batchSize) const {
+        if (sparseSettings.mode != SparseInput::Mode::Off && !layers.empty()) {
+            const Layer<T, Master> &first = layers.front().layer;
+            ws.csr.reserve(batchSize, first.inputSize());
+            ws.gradientByInput.resize(first.outputSize(), first.inputSize());
+            ws.rowGradient.resize(first.outputSize());
+        }
+        for (std::size_t l = 0; l < layers.size(); ++l) {
+            const Eigen::Index size = batchSize * layers[l].layer.outputSize();
+            ws.layers[l].output.reserve(size);
+            ws.layers[l].delta.reserve(size);
+            if (std::holds_alternative<CustomActivation>(layers[l].activation)) {
+                ws.layers[l].preActivation.reserve(size);
+                ws.derivative.reserve(size);
+            }
+        }
+    }
+
+    // Returns a view of the logits that stays valid until the next forward call. The input is referenced, not
+    // copied, so it must stay alive and unchanged until backward() has run.
+    ConstView forward(ConstMatrixRef<T> input) {
+        return forward(input, workspace);
+    }
+
+    ConstView forward(ConstMatrixRef<T> input, Workspace &ws) const {
+        const Eigen::Index rows = input.rows();
+        ws.inputData = input.data();
+        ws.inputRows = rows;
+        ws.inputStride = input.outerStride();
+        // Measuring the density is part of the conversion; denser batches than the threshold stay dense. A batch
+        // that qualifies while the transposed weights are stale runs dense and asks the next update to refresh them.
+        ws.sparseInput = false;
+        if (sparseSettings.mode != SparseInput::Mode::Off && !layers.empty() &&
+            ws.csr.assign(input, sparseSettings.mode == SparseInput::Mode::On
+                                 ? 1.0 : SparseInput::threshold<T>(sparseSettings))) {
+            std::atomic_ref<bool>(sparseWanted).store(true, std::memory_order_relaxed);
+            ws.sparseInput = layers.front().layer.weightsByInputCurrent();
+        }
+        for (std::size_t l = 0; l < layers.size(); ++l) {
+            const auto &layer = layers[l];
+            auto &state = ws.layers[l];
+            const Eigen::Index size = layer.layer.outputSize();
+            const ConstMatrixRef<T> layerInput = l == 0 ? input : ConstMatrixRef<T>(output(ws, l - 1, rows));
+            auto layerOutput = state.output.view(rows, size);
+            std::visit([&](const auto &activation) {
+                using Act = std::decay_t<decltype(activation)>;
+                const bool sparse = l == 0 && ws.sparseInput;
+                if constexpr (std::is_same_v<Act, CustomActivation>) {
+                    auto preActivation = state.preActivation.view(rows, size);
+                    if (sparse) {
+                        layer.layer.forward(ws.csr, preActivation);
+                    } else {
+                        layer.layer.forward(layerInput, preActivation);
+                    }
+                    activation.function(preActivation, layerOutput);
+                } else if (sparse) {
+                    layer.layer.template forward<Act>(ws.csr, layerOutput);
+                } else {
+                    layer.layer.template forward<Act>(layerInput, layerOutput);
+                }
+            }, layer.activation);
+        }
+        return output(ws, layers.size() - 1, rows); // Output is logits (last layer uses identity)
+    }
+
+    void backward(ConstMatrixRef<T> gradOutput) {
+        backward(gradOutput, workspace);
+    }
+
+    // Computes the gradients of the last forward pass in ws. Bias gradients are averaged over the batch.
+    void backward(ConstMatrixRef<T> gradOutput, Workspace &ws) const {
+        accumulateGradients(gradOutput, ws);
+        normalizeGradients(ws, gradOutput.rows());
+    }
+
+    // Computes the gradients of the last forward pass in ws, summed over the batch rows. Used by trainers that
+    // split a batch into shards and reduce the shard gradients before calling normalizeGradients.
+    void accumulateGradients(ConstMatrixRef<T> gradOutput, Workspace &ws) const {
+        const Eigen::Index rows = gradOutput.rows();
+        for (std::size_t l = layers.size(); l-- > 0;) {
+            const auto &layer = layers[l];
+            auto &state = ws.layers[l];
+            const Eigen::Index size = layer.layer.outputSize();
+            const bool isLast = l + 1 == layers.size();
+            // delta already holds the gradient from the layer above, except for the last layer
+            auto delta = state.delta.view(rows, size);
+            const bool passThrough = isLast && std::holds_alternative<Activation::Identity>(layer.activation);
+            if (isLast && !passThrough) {
+                delta = gradOutput;
+            }
+            // Apply activation derivative in place
+            std::visit([&](const auto &activation) {
+                using Act = std::decay_t<decltype(activation)>;
+                if constexpr (std::is_same_v<Act, CustomActivation>) {
+                    auto activationGrad = ws.derivative.view(rows, size);
+                    activation.derivative(state.preActivation.view(rows, size), activationGrad);
+                    delta.array() *= activationGrad.array();
+                } else {
+                    Act::template backward<T>(output(ws, l, rows), delta);
+                }
+            }, layer.activation);
+            const ConstMatrixRef<T> layerGrad = passThrough ? gradOutput : ConstMatrixRef<T>(delta);
             // Propagate through layer
-            grad = it->layer.backward(grad);
+            if (l == 0 && ws.sparseInput) {
+                layer.layer.backward(ws.csr, layerGrad, state.gradients, ws.gradientByInput, ws.rowGradient);
+            } else if (l == 0) {
+                const typename Workspace::InputMap input(ws.inputData, ws.inputRows, layer.layer.inputSize(),
+                                                         Eigen::OuterStride<>(ws.inputStride));
+                layer.layer.backward(input, layerGrad, state.gradients);
+            } else {
+                auto gradInput = ws.layers[l - 1].delta.view(rows, layers[l - 1].layer.outputSize());
+                layer.layer.backward(output(ws, l - 1, rows), layerGrad, state.gradients, gradInput);
+            }
         }
     }
 
-    void updateWeights(Precision learningRate) {
-        for (auto &layer : layers) {
-            layer.layer.updateWeights(learningRate);
+    // Turns summed bias gradients into averages over a batch of the given number of rows.
+    void normalizeGradients(Workspace &ws, Eigen::Index rows) const {
+        const T scale = T(std::max(static_cast<int>(rows - 1), 1)) * biasBatchScale;
+        for (auto &state : ws.layers) {
+            state.gradients.biases /= scale;
+        }
+    }
+
+    void updateWeights(Master learningRate) {
+        updateWeights(learningRate, workspace);
+    }
+
+    // Applies the gradients held by ws with the configured optimizer. Hogwild threads call this concurrently, so
+    // the step counter is advanced atomically.
+    void updateWeights(Master learningRate, const Workspace &ws) {
+        TRACE_SCOPE("update_weights");
+        const std::uint64_t t =
+                std::atomic_ref<std::uint64_t>(optimizerSteps).fetch_add(1, std::memory_order_relaxed) + 1;
+        const Optimizer::Step<Master> step(optimizerSettings, learningRate, t);
+        // Keep the transposed first-layer weights current while batches take the sparse path
+        const bool refresh = sparseSettings.mode == SparseInput::Mode::On ||
+                             std::atomic_ref<bool>(sparseWanted).exchange(false, std::memory_order_relaxed);
+        for (std::size_t l = 0; l < layers.size(); ++l) {
+            layers[l].layer.updateWeights(step, ws.layers[l].gradients, l == 0 && refresh);
         }
     }
 
+    [[nodiscard]] std::size_t layerCount() const { return layers.size(); }
+    [[nodiscard]] const Layer<T, Master> &layer(std::size_t l) const { return layers[l].layer; }
+    [[nodiscard]] Layer<T, Master> &layer(std::size_t l) { return layers[l].layer; }
+    // 0 for Activation::ReLU, 1 for Activation::Identity, 2 for custom activation functions
+    [[nodiscard]] std::size_t activationIndex(std::size_t l) const { return layers[l].activation.index(); }
+    [[nodiscard]] Eigen::Index outputSize() const { return layers.back().layer.outputSize(); }
+
+    // Number of default workspace (re)allocations so far; constant once the buffers fit the largest batch.
+    [[nodiscard]] std::size_t workspaceAllocations() const {
+        return workspace.allocations();
+    }
+
 private:
+    // Activation given as a pair of functions, evaluated in separate passes.
+    struct CustomActivation {
+        ActivationFunction function;
+        ActivationFunction derivative;
+    };
+
     struct LayerEntry {
-        Layer layer;
-        std::function<Matrix(const Matrix&)> activation;
-        std::function<Matrix(const Matrix&)> activationDerivative;
-        Matrix preActivation;  // Stores layer output before activation
-        Matrix postActivation; // Stores layer output after activation
+        Layer<T, Master> layer;
+        std::variant<Activation::ReLU, Activation::Identity, CustomActivation> activation;
     };
     std::vector<LayerEntry> layers;
+    Workspace workspace;
+    Optimizer::Settings optimizerSettings;
+    std::uint64_t optimizerSteps = 0;
+    SparseInput::Settings sparseSettings;
+    T biasBatchScale = 1; // See setBatchSizeCompensation
+    Rng::Stream initialization = Rng::Stream(Rng::defaultSeed).split(Rng::Purpose::Initialization);
+    mutable bool sparseWanted = false; // A batch since the last update qualified for the sparse path
+    int reservedRows = 0; // Largest batch the default workspace was reserved for
+
+    ConstView output(const Workspace &ws, std::size_t l, Eigen::Index rows) const {
+        return ws.layers[l].output.view(rows, layers[l].layer.outputSize());
+    }
+
+    static bool holds(const ActivationFunction &function, void (*expected)(ConstMatrixRef<T>, MatrixRef<T>)) {
+        const auto *target = function.template target<void (*)(ConstMatrixRef<T>, MatrixRef<T>)>();
+        return target != nullptr && *target == expected;
+    }
 };
 
-#endif //PERCEPTRON_COMPONENTS_H
\ No newline at end of file
+#endif //PERCEPTRON_COMPONENTS_H
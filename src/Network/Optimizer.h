@@ -0,0 +1,141 @@
+#ifndef PERCEPTRON_OPTIMIZER_H
+#define PERCEPTRON_OPTIMIZER_H
+
+#pragma once
+
+#include <Eigen/Dense>
+#include <cmath>
+#include <cstdint>
+#include <stdexcept>
+#include <string>
+
+// Parameter update rules. Every rule is applied in a single pass over parameters, gradients and state buffers;
+// with mixed precision the same pass also refreshes the compute copy of the parameters.
+namespace Optimizer {
+    // The values are stored in checkpoints; do not renumber.
+    enum class Kind : std::uint32_t {
+        SGD = 0,
+        Momentum = 1, // v = momentum * v + g; w -= lr * v
+        Nesterov = 2, // v = momentum * v + g; w -= lr * (g + momentum * v)
+        Adam = 3,
+        AdamW = 4     // Adam with weight decay applied to the weights directly instead of through the gradient
+    };
+
+    struct Settings {
+        Kind kind = Kind::SGD;
+        double momentum = 0.9;
+        double beta1 = 0.9;
+        double beta2 = 0.999;
+        double epsilon = 1e-8;
+        // L2 penalty on the weights (not the biases); decoupled for AdamW
+        double weightDecay = 0.0;
+    };
+
+    inline Kind parseKind(const std::string &name) {
+        if (name == "sgd") return Kind::SGD;
+        if (name == "momentum") return Kind::Momentum;
+        if (name == "nesterov") return Kind::Nesterov;
+        if (name == "adam") return Kind::Adam;
+        if (name == "adamw") return Kind::AdamW;
+        throw std::invalid_argument("Unknown optimizer: " + name);
+    }
+
+    // Number of parameter-shaped state buffers the rule keeps.
+    inline int stateBlocks(Kind kind) {
+        switch (kind) {
+            case Kind::SGD:
+                return 0;
+            case Kind::Momentum:
+            case Kind::Nesterov:
+                return 1;
+            case Kind::Adam:
+            case Kind::AdamW:
+                return 2;
+        }
+        return 0;
+    }
+
+    // Everything one update needs, with the bias corrections of step t already folded in.
+    template<typename Master>
+    struct Step {
+        Kind kind;
+        Master learningRate;
+        Master momentum;
+        Master beta1;
+        Master beta2;
+        Master epsilon;
+        Master weightDecay;
+        Master correction1; // 1 - beta1^t
+        Master correction2; // 1 - beta2^t
+
+        Step(const Settings &settings, Master learningRate, std::uint64_t t)
+                : kind(settings.kind), learningRate(learningRate), momentum(Master(settings.momentum)),
+                  beta1(Master(settings.beta1)), beta2(Master(settings.beta2)), epsilon(Master(settings.epsilon)),
+                  weightDecay(Master(settings.weightDecay)),
+                  correction1(Master(1 - std::pow(settings.beta1, static_cast<double>(t)))),
+                  correction2(Master(1 - std::pow(settings.beta2, static_cast<double>(t)))) {}
+    };
+
+    // Applies one step to size parameters. gradient may be in a lower precision than the parameters; if copy is
+    // not null, it receives the updated parameters in that precision. first and second are the state buffers
+    // (unused ones may be null). decay selects whether weightDecay applies to these parameters.
+    template<typename Master, typename T>
+    void update(const Step<Master> &step, Master *__restrict parameters, const T *__restrict gradient,
+                Master *__restrict first, Master *__restrict second, T *__restrict copy, Eigen::Index size,
+                bool decay) {
+        const Master lr = step.learningRate;
+        const Master wd = decay ? step.weightDecay : Master(0);
+        // The rule is a lambda so each case compiles into its own branch-free, vectorizable loop.
+        auto apply = [&](auto rule) {
+            if (copy) {
+                for (Eigen::Index i = 0; i < size; ++i) {
+                    parameters[i] = rule(i, parameters[i], static_cast<Master>(gradient[i]));
+                    copy[i] = static_cast<T>(parameters[i]);
+                }
+            } else {
+                for (Eigen::Index i = 0; i < size; ++i) {
+                    parameters[i] = rule(i, parameters[i], static_cast<Master>(gradient[i]));
+                }
+            }
+        };
+        switch (step.kind) {
+            case Kind::SGD:
+                apply([&](Eigen::Index, Master w, Master g) { return w - lr * (g + wd * w); });
+                break;
+            case Kind::Momentum:
+                apply([&](Eigen::Index i, Master w, Master g) {
+                    const Master v = step.momentum * first[i] + g + wd * w;
+                    first[i] = v;
+                    return w - lr * v;
+                });
+                break;
+            case Kind::Nesterov:
+                apply([&](Eigen::Index i, Master w, Master g) {
+                    g += wd * w;
+                    const Master v = step.momentum * first[i] + g;
+                    first[i] = v;
+                    return w - lr * (g + step.momentum * v);
+                });
+                break;
+            case Kind::Adam:
+            case Kind::AdamW: {
+                const bool decoupled = step.kind == Kind::AdamW;
+                const Master coupledDecay = decoupled ? Master(0) : wd;
+                const Master decoupledDecay = decoupled ? lr * wd : Master(0);
+                const Master stepSize = lr / step.correction1;
+                const Master inverseCorrection2 = Master(1) / step.correction2;
+                apply([&](Eigen::Index i, Master w, Master g) {
+                    g += coupledDecay * w;
+                    const Master m = step.beta1 * first[i] + (Master(1) - step.beta1) * g;
+                    const Master v = step.beta2 * second[i] + (Master(1) - step.beta2) * g * g;
+                    first[i] = m;
+                    second[i] = v;
+                    return w - decoupledDecay * w - stepSize * m / (std::sqrt(v * inverseCorrection2) + step.epsilon);
+                });
+                break;
+            }
+        }
+    }
+}
+
+#endif //PERCEPTRON_OPTIMIZER_H
@@ -0,0 +1,156 @@
+#ifndef PERCEPTRON_QUANTIZED_H
+#define PERCEPTRON_QUANTIZED_H
+
+#pragma once
+
+#include <Eigen/Dense>
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <stdexcept>
+#include <vector>
+#include "../Compute/Gemm.h"
+#include "Components.h"
+
+// Post-training int8 quantization of a Network for inference. Weights are quantized symmetrically per output channel
+// (scale max |w| / 127); biases stay float. The first layer reads raw uint8 pixels, whose scale is 1/255 as in
+// MNISTLoader, and every later layer reads the ReLU output of the layer below, quantized per row to uint8 with scale
+// max / 255. A layer is one exact uint8 x int8 -> int32 product (Compute::gemmU8S8) followed by a float pass that
+// applies the scales, the bias and the activation. Hidden layers must use Activation::ReLU so that their outputs
+// are non-negative; the weights take a quarter of the memory of float ones.
+class QuantizedNetwork {
+public:
+    using Logits = Eigen::Map<const Eigen::Matrix<float, Eigen::Dynamic, Eigen::Dynamic, Eigen::RowMajor>>;
+
+    // Activations of a forward pass; sized by makeWorkspace() so that batches up to that size do not allocate.
+    class Workspace {
+        friend class QuantizedNetwork;
+        std::vector<std::uint8_t> activations; // Quantized input of the current layer, row-major
+        std::vector<float> rowScales;          // Scale of every row of activations
+        std::vector<std::int32_t> products;    // Integer product of the current layer, row-major
+        std::vector<float> outputs;            // Dequantized output of the current layer, row-major
+    };
+
+    template<typename T, typename Master>
+    explicit QuantizedNetwork(const Network<T, Master> &network) {
+        for (std::size_t l = 0; l < network.layerCount(); ++l) {
+            const bool last = l + 1 == network.layerCount();
+            const std::size_t activation = network.activationIndex(l);
+            if (activation > 1 || (!last && activation != 0)) {
+                throw std::invalid_argument("Int8 inference needs ReLU hidden layers and a ReLU or identity output");
+            }
+            const auto &weights = network.layer(l).parameterWeights();
+            const auto &biases = network.layer(l).parameterBiases();
+            QuantizedLayer layer;
+            layer.inputs = static_cast<int>(weights.rows());
+            layer.outputs = static_cast<int>(weights.cols());
+            layer.relu = activation == 0;
+            layer.weights.resize(weights.size());
+            layer.scales.resize(layer.outputs);
+            layer.biases.resize(layer.outputs);
+            // Column j of the weights holds output channel j, which becomes row j of the int8 matrix
+            for (int j = 0; j < layer.outputs; ++j) {
+                const double largest = static_cast<double>(weights.col(j).cwiseAbs().maxCoeff());
+                const double scale = largest > 0 ? largest / 127.0 : 1.0;
+                for (int i = 0; i < layer.inputs; ++i) {
+                    const double value = std::nearbyint(static_cast<double>(weights(i, j)) / scale);
+                    layer.weights[static_cast<std::size_t>(j) * layer.inputs + i] =
+                            static_cast<std::int8_t>(std::clamp(value, -127.0, 127.0));
+                }
+                layer.scales[j] = static_cast<float>(scale);
+                layer.biases[j] = static_cast<float>(biases(j));
+            }
+            layers.push_back(std::move(layer));
+        }
+    }
+
+    [[nodiscard]] Workspace makeWorkspace(int batchSize) const {
+        Workspace ws;
+        reserve(ws, batchSize);
+        return ws;
+    }
+
+    // Returns the logits of a batch of raw pixels (rows x inputSize(), row-major, e.g. MNISTLoader::rawImage);
+    // they stay valid until the next forward call with ws.
+    Logits forward(const std::uint8_t *pixels, int rows, Workspace &ws) const {
+        reserve(ws, rows);
+        const Compute::Backend backend = Compute::activeBackend();
+        const std::uint8_t *input = pixels;
+        std::fill_n(ws.rowScales.begin(), rows, 1.0f / 255.0f);
+        for (std::size_t l = 0; l < layers.size(); ++l) {
+            const QuantizedLayer &layer = layers[l];
+            const int n = layer.outputs;
+            Compute::gemmU8S8(backend, rows, n, layer.inputs, input, layer.inputs, layer.weights.data(),
+                              layer.inputs, ws.products.data(), n);
+            for (int i = 0; i < rows; ++i) {
+                const float rowScale = ws.rowScales[i];
+                const std::int32_t *product = ws.products.data() + static_cast<std::size_t>(i) * n;
+                float *output = ws.outputs.data() + static_cast<std::size_t>(i) * n;
+                for (int j = 0; j < n; ++j) {
+                    const float value = static_cast<float>(product[j]) * (rowScale * layer.scales[j]) +
+                                        layer.biases[j];
+                    output[j] = layer.relu ? std::max(value, 0.0f) : value;
+                }
+            }
+            if (l + 1 < layers.size()) {
+                quantizeRows(ws, rows, n);
+                input = ws.activations.data();
+            }
+        }
+        return Logits(ws.outputs.data(), rows, layers.back().outputs);
+    }
+
+    [[nodiscard]] int inputSize() const { return layers.front().inputs; }
+    [[nodiscard]] int outputSize() const { return layers.back().outputs; }
+
+    // Bytes of the int8 weights plus the float scales and biases.
+    [[nodiscard]] std::size_t parameterBytes() const {
+        std::size_t bytes = 0;
+        for (const auto &layer : layers) {
+            bytes += layer.weights.size() + (layer.scales.size() + layer.biases.size()) * sizeof(float);
+        }
+        return bytes;
+    }
+
+private:
+    struct QuantizedLayer {
+        int inputs = 0;
+        int outputs = 0;
+        bool relu = false;
+        std::vector<std::int8_t> weights; // outputs x inputs, row-major
+        std::vector<float> scales;        // Per output channel
+        std::vector<float> biases;
+    };
+    std::vector<QuantizedLayer> layers;
+
+    void reserve(Workspace &ws, int rows) const {
+        std::size_t widest = 0;
+        for (const auto &layer : layers) {
+            widest = std::max<std::size_t>(widest, layer.outputs);
+        }
+        const std::size_t size = static_cast<std::size_t>(rows) * widest;
+        if (ws.outputs.size() < size) {
+            ws.activations.resize(size);
+            ws.rowScales.resize(rows);
+            ws.products.resize(size);
+            ws.outputs.resize(size);
+        }
+    }
+
+    // Quantizes the non-negative rows of ws.outputs into ws.activations with one scale per row.
+    static void quantizeRows(Workspace &ws, int rows, int n) {
+        for (int i = 0; i < rows; ++i) {
+            const float *output = ws.outputs.data() + static_cast<std::size_t>(i) * n;
+            std::uint8_t *activation = ws.activations.data() + static_cast<std::size_t>(i) * n;
+            const float largest = *std::max_element(output, output + n);
+            const float scale = largest > 0 ? largest / 255.0f : 1.0f;
+            const float inverse = 1.0f / scale;
+            for (int j = 0; j < n; ++j) {
+                activation[j] = static_cast<std::uint8_t>(std::min(output[j] * inverse + 0.5f, 255.0f));
+            }
+            ws.rowScales[i] = scale;
+        }
+    }
+};
+
+#endif //PERCEPTRON_QUANTIZED_H
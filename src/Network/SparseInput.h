@@ -0,0 +1,197 @@
+#ifndef PERCEPTRON_SPARSEINPUT_H
+#define PERCEPTRON_SPARSEINPUT_H
+
+#pragma once
+
+#include <Eigen/Dense>
+#include <algorithm>
+#include <cstddef>
+#include <stdexcept>
+#include <string>
+#include <type_traits>
+#include <vector>
+#include "../Compute/Gemm.h"
+#include "Types.hpp"
+
+// Sparse input path of the first layer. MNIST images are about 80% zero pixels, so a batch stored as compressed
+// sparse rows (CSR) needs only a fifth of the multiply-adds of the dense first-layer GEMM for the forward pass
+// and for the weight gradient. The kernels walk the nonzeros of a row and update contiguous runs of the
+// layer's transposed weights (one row of outputs per input pixel), so the inner loops vectorize like the dense
+// ones.
+namespace SparseInput {
+    enum class Mode {
+        Off,  // Always use the dense GEMM
+        Auto, // Use the sparse kernels for batches whose measured density is at most the threshold
+        On    // Always use the sparse kernels
+    };
+
+    struct Settings {
+        // Opt-in: the sparse kernels change the summation order and so the rounding of the first layer
+        Mode mode = Mode::Off;
+        // Highest fraction of nonzero inputs for which Auto picks the sparse kernels; negative selects the
+        // default of the active GEMM backend
+        double threshold = -1.0;
+    };
+
+    // Measured break-even densities of the sparse kernels against the dense GEMM (see perceptron_bench
+    // layer_*_sparse): about 0.3 against Eigen with SSE2, but only about 0.05 against the AVX2/AVX-512 kernels.
+    inline double defaultThreshold(Compute::Backend backend) {
+        return backend == Compute::Backend::Eigen ? 0.3 : 0.05;
+    }
+
+    // Threshold for inputs of type T; only float products use the SIMD backends.
+    template<typename T>
+    double threshold(const Settings &settings) {
+        if (settings.threshold >= 0) {
+            return settings.threshold;
+        }
+        return defaultThreshold(Compute::gemmBackend<T>());
+    }
+
+    inline Mode parseMode(const std::string &name) {
+        if (name == "off") return Mode::Off;
+        if (name == "auto") return Mode::Auto;
+        if (name == "on") return Mode::On;
+        throw std::invalid_argument("Unknown sparse input mode: " + name);
+    }
+
+    inline const char *modeName(Mode mode) {
+        switch (mode) {
+            case Mode::Off:
+                return "off";
+            case Mode::Auto:
+                return "auto";
+            case Mode::On:
+                return "on";
+        }
+        return "unknown";
+    }
+
+    // A batch in compressed sparse row format: the nonzeros of row i are at positions [begin(i), end(i)), in
+    // ascending column order. Sized once by reserve(), so converting batches does not allocate.
+    template<typename T>
+    class CsrBatch {
+    public:
+        void reserve(Eigen::Index rows, Eigen::Index cols) {
+            if (rows + 1 > static_cast<Eigen::Index>(rowStart.size()) ||
+                rows * cols > static_cast<Eigen::Index>(columns.size())) {
+                rowStart.resize(std::max<std::size_t>(rowStart.size(), rows + 1));
+                columns.resize(std::max<std::size_t>(columns.size(), rows * cols));
+                values.resize(std::max<Eigen::Index>(values.size(), rows * cols));
+                ++growCount;
+            }
+        }
+
+        // Converts dense unless more than maxDensity of its entries are nonzero; returns whether it did. The
+        // nonzeros are counted per row in a first pass, which is also the density measurement.
+        bool assign(ConstMatrixRef<T> dense, double maxDensity) {
+            const Eigen::Index rows = dense.rows();
+            const Eigen::Index cols = dense.cols();
+            reserve(rows, cols);
+            std::fill(rowStart.begin(), rowStart.begin() + rows + 1, 0);
+            // Stops counting as soon as the batch is too dense
+            const auto limit = static_cast<Eigen::Index>(maxDensity * static_cast<double>(rows * cols));
+            Eigen::Index nonzeros = 0;
+            for (Eigen::Index j = 0; j < cols; ++j) {
+                for (Eigen::Index i = 0; i < rows; ++i) {
+                    const bool nonzero = dense(i, j) != T(0);
+                    rowStart[i + 1] += nonzero;
+                    nonzeros += nonzero;
+                }
+                if (nonzeros > limit) {
+                    return false;
+                }
+            }
+            for (Eigen::Index i = 0; i < rows; ++i) {
+                rowStart[i + 1] += rowStart[i];
+            }
+            // Column-major input: walking columns in the outer loop fills every row in ascending column order
+            for (Eigen::Index j = 0; j < cols; ++j) {
+                for (Eigen::Index i = 0; i < rows; ++i) {
+                    const T value = dense(i, j);
+                    if (value != T(0)) {
+                        const int position = rowStart[i]++;
+                        columns[position] = static_cast<int>(j);
+                        values[position] = value;
+                    }
+                }
+            }
+            // rowStart[i] now holds the end of row i; shift back to the starts
+            for (Eigen::Index i = rows; i > 0; --i) {
+                rowStart[i] = rowStart[i - 1];
+            }
+            rowStart[0] = 0;
+            rows_ = rows;
+            cols_ = cols;
+            return true;
+        }
+
+        [[nodiscard]] Eigen::Index rows() const { return rows_; }
+        [[nodiscard]] Eigen::Index cols() const { return cols_; }
+        [[nodiscard]] int begin(Eigen::Index row) const { return rowStart[row]; }
+        [[nodiscard]] int end(Eigen::Index row) const { return rowStart[row + 1]; }
+        [[nodiscard]] int column(int position) const { return columns[position]; }
+        [[nodiscard]] T value(int position) const { return values[position]; }
+
+        // Number of times the storage had to (re)allocate.
+        [[nodiscard]] std::size_t allocations() const { return growCount; }
+
+    private:
+        std::vector<int> rowStart;
+        std::vector<int> columns;
+        VectorT<T> values;
+        Eigen::Index rows_ = 0;
+        Eigen::Index cols_ = 0;
+        std::size_t growCount = 0;
+    };
+
+    // Outputs per block of the kernels; the accumulators of one block stay in registers.
+    constexpr int blockSize = 32;
+
+    // output = Act(input * weightsByInput^T + biases), where weightsByInput holds the transposed weights
+    // (outputs x inputs) so that the weights of one input are contiguous.
+    template<typename Act, typename T>
+    void forward(const CsrBatch<T> &input, const MatrixT<T> &weightsByInput, const VectorT<T> &biases,
+                 MatrixRef<T> output) {
+        using Block = Eigen::Array<T, blockSize, 1>;
+        const Eigen::Index outputs = weightsByInput.rows();
+        auto run = [&](Eigen::Index row, Eigen::Index first, auto accumulator) {
+            const Eigen::Index count = accumulator.size();
+            accumulator = biases.segment(first, count).array();
+            for (int p = input.begin(row); p < input.end(row); ++p) {
+                accumulator += input.value(p) * weightsByInput.col(input.column(p)).segment(first, count).array();
+            }
+            if constexpr (Act::isIdentity) {
+                output.row(row).segment(first, count) = accumulator.matrix().transpose();
+            } else {
+                output.row(row).segment(first, count) =
+                        accumulator.unaryExpr([](T x) { return Act::template apply<T>(x); }).matrix().transpose();
+            }
+        };
+        for (Eigen::Index row = 0; row < input.rows(); ++row) {
+            Eigen::Index first = 0;
+            for (; first + blockSize <= outputs; first += blockSize) {
+                run(row, first, Block());
+            }
+            if (first < outputs) {
+                run(row, first, Eigen::Array<T, Eigen::Dynamic, 1, 0, blockSize, 1>(outputs - first));
+            }
+        }
+    }
+
+    // gradientByInput = (input^T * gradOutput)^T, i.e. the weight gradient in the transposed layout
+    // (outputs x inputs). rowGradient is scratch space for one row of gradOutput.
+    template<typename T>
+    void weightGradient(const CsrBatch<T> &input, ConstMatrixRef<T> gradOutput, MatrixT<T> &gradientByInput,
+                        VectorT<T> &rowGradient) {
+        gradientByInput.setZero();
+        for (Eigen::Index row = 0; row < input.rows(); ++row) {
+            rowGradient = gradOutput.row(row).transpose();
+            for (int p = input.begin(row); p < input.end(row); ++p) {
+                gradientByInput.col(input.column(p)).noalias() += input.value(p) * rowGradient;
+            }
+        }
+    }
+}
+
+#endif //PERCEPTRON_SPARSEINPUT_H
@@ -4,11 +4,26 @@
 
 #include <Eigen/Dense>
 
-// Define a type alias for precision. Change this to float for single precision.
+// Default scalar type. Network, Layer, the activation/loss functions and MNISTLoader are templated
+// on the scalar type; the precision used by MnistModel is selected with the "precision" config key.
 using Precision = double;
 
+// Define matrix and vector types for an arbitrary scalar type.
+template<typename T>
+using MatrixT = Eigen::Matrix<T, Eigen::Dynamic, Eigen::Dynamic>;
+template<typename T>
+using VectorT = Eigen::Matrix<T, Eigen::Dynamic, 1>;
+
+// References that bind to matrices, maps and blocks without copying.
+template<typename T>
+using MatrixRef = Eigen::Ref<MatrixT<T>>;
+template<typename T>
+using ConstMatrixRef = Eigen::Ref<const MatrixT<T>>;
+template<typename T>
+using VectorRef = Eigen::Ref<VectorT<T>>;
+
 // Define matrix and vector types based on Precision.
-using Matrix = Eigen::Matrix<Precision, Eigen::Dynamic, Eigen::Dynamic>;
-using Vector = Eigen::Matrix<Precision, Eigen::Dynamic, 1>;
+using Matrix = MatrixT<Precision>;
+using Vector = VectorT<Precision>;
 
-#endif // TYPES_H
\ No newline at end of file
+#endif // TYPES_H
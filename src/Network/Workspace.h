@@ -0,0 +1,44 @@
+#ifndef PERCEPTRON_WORKSPACE_H
+#define PERCEPTRON_WORKSPACE_H
+
+#pragma once
+
+#include <cstddef>
+#include <Eigen/Dense>
+#include "Types.hpp"
+
+// Reusable storage for batch-sized intermediate results. A buffer is sized once for the largest batch and
+// handed out as contiguous views of the current batch size, so steady-state steps never touch the heap.
+template<typename T>
+class Buffer {
+public:
+    using View = Eigen::Map<MatrixT<T>, Eigen::AlignedMax>;
+    using ConstView = Eigen::Map<const MatrixT<T>, Eigen::AlignedMax>;
+
+    // Ensures capacity for at least size elements. Contents are not preserved when the buffer grows.
+    void reserve(Eigen::Index size) {
+        if (size > storage.size()) {
+            storage.resize(size);
+            ++growCount;
+        }
+    }
+
+    View view(Eigen::Index rows, Eigen::Index cols) {
+        reserve(rows * cols);
+        return View(storage.data(), rows, cols);
+    }
+
+    [[nodiscard]] ConstView view(Eigen::Index rows, Eigen::Index cols) const {
+        eigen_assert(rows * cols <= storage.size());
+        return ConstView(storage.data(), rows, cols);
+    }
+
+    // Number of times the buffer had to (re)allocate its storage.
+    [[nodiscard]] std::size_t allocations() const { return growCount; }
+
+private:
+    VectorT<T> storage;
+    std::size_t growCount = 0;
+};
+
+#endif //PERCEPTRON_WORKSPACE_H
@@ -0,0 +1,91 @@
+#include "ThreadPool.h"
+
+#include <stdexcept>
+#include <string>
+#include "../Metrics/Trace.h"
+
+ThreadPool::ThreadPool(int threadCount) {
+    if (threadCount < 1) {
+        throw std::invalid_argument("ThreadPool needs at least one thread");
+    }
+    workers.reserve(threadCount - 1);
+    for (int i = 1; i < threadCount; ++i) {
+        workers.emplace_back(&ThreadPool::workerLoop, this, i);
+    }
+}
+
+ThreadPool::~ThreadPool() {
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        stopping = true;
+    }
+    wake.notify_all();
+    for (auto& worker : workers) {
+        worker.join();
+    }
+}
+
+void ThreadPool::dispatch(void (*function)(void*, int), void* context) {
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        taskFunction = function;
+        taskContext = context;
+        pending = static_cast<int>(workers.size());
+        error = nullptr;
+        ++generation;
+    }
+    wake.notify_all();
+
+    std::exception_ptr localError;
+    try {
+        function(context, 0);
+    } catch (...) {
+        localError = std::current_exception();
+    }
+
+    std::unique_lock<std::mutex> lock(mutex);
+    done.wait(lock, [this] { return pending == 0; });
+    if (!localError) {
+        localError = error;
+    }
+    lock.unlock();
+    if (localError) {
+        std::rethrow_exception(localError);
+    }
+}
+
+void ThreadPool::workerLoop(int index) {
+    TRACE_THREAD_NAME("worker " + std::to_string(index));
+    std::uint64_t seenGeneration = 0;
+    while (true) {
+        void (*function)(void*, int);
+        void* context;
+        {
+            std::unique_lock<std::mutex> lock(mutex);
+            wake.wait(lock, [&] { return stopping || generation != seenGeneration; });
+            if (stopping) {
+                return;
+            }
+            seenGeneration = generation;
+            function = taskFunction;
+            context = taskContext;
+        }
+
+        std::exception_ptr taskError;
+        try {
+            function(context, index);
+        } catch (...) {
+            taskError = std::current_exception();
+        }
+
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            if (taskError && !error) {
+                error = taskError;
+            }
+            if (--pending == 0) {
+                done.notify_one();
+            }
+        }
+    }
+}
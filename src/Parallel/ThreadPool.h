@@ -0,0 +1,56 @@
+#ifndef PERCEPTRON_THREADPOOL_H
+#define PERCEPTRON_THREADPOOL_H
+
+#pragma once
+
+#include <condition_variable>
+#include <cstdint>
+#include <exception>
+#include <mutex>
+#include <thread>
+#include <type_traits>
+#include <vector>
+
+// Fixed set of threads that run one indexed task per thread. run() returns once every task has finished.
+// Task i always runs on the same thread and the calling thread runs task 0, so a pool of size 1 runs
+// everything inline. Dispatching a task does not allocate.
+class ThreadPool {
+public:
+    explicit ThreadPool(int threadCount);
+
+    ~ThreadPool();
+
+    ThreadPool(const ThreadPool& other) = delete;
+    ThreadPool& operator=(const ThreadPool& other) = delete;
+
+    // Calls task(i) for every i in [0, size()). The first exception thrown by a task is rethrown here.
+    template<typename F>
+    void run(F&& task) {
+        dispatch(&invoke<std::remove_reference_t<F>>, &task);
+    }
+
+    [[nodiscard]] int size() const { return static_cast<int>(workers.size()) + 1; }
+
+private:
+    template<typename F>
+    static void invoke(void* task, int index) {
+        (*static_cast<F*>(task))(index);
+    }
+
+    void dispatch(void (*function)(void*, int), void* context);
+
+    void workerLoop(int index);
+
+    std::vector<std::thread> workers;
+    std::mutex mutex;
+    std::condition_variable wake;
+    std::condition_variable done;
+    std::uint64_t generation = 0;
+    int pending = 0;
+    bool stopping = false;
+    void (*taskFunction)(void*, int) = nullptr;
+    void* taskContext = nullptr;
+    std::exception_ptr error;
+};
+
+#endif //PERCEPTRON_THREADPOOL_H
@@ -0,0 +1,109 @@
+#include "PredictionLogWriter.h"
+
+#include <algorithm>
+#include <charconv>
+
+PredictionLogWriter::PredictionLogWriter(const std::string& path, int batchSize, int chunkSize)
+        : file(std::fopen(path.c_str(), "w")), batchSize(batchSize), chunks(chunkCount) {
+    if (file != nullptr) {
+        block.reserve(blockSize + 256);
+        for (auto& chunk : chunks) {
+            chunk.predictions.resize(std::max(chunkSize, 1));
+            chunk.labels.resize(std::max(chunkSize, 1));
+        }
+        writerThread = std::thread(&PredictionLogWriter::run, this);
+    }
+}
+
+PredictionLogWriter::~PredictionLogWriter() {
+    close();
+}
+
+void PredictionLogWriter::write(int firstImage, const int* predictions, const int* labels, int count) {
+    if (file == nullptr) {
+        return;
+    }
+    const int capacity = static_cast<int>(chunks.front().predictions.size());
+    for (int offset = 0; offset < count; offset += capacity) {
+        const int size = std::min(capacity, count - offset);
+        std::unique_lock<std::mutex> lock(mutex);
+        recycled.wait(lock, [this] { return queued < chunks.size(); });
+        // Slots outside [head, head + queued) are not touched by the writer
+        Chunk& chunk = chunks[(head + queued) % chunks.size()];
+        chunk.firstImage = firstImage + offset;
+        chunk.count = size;
+        std::copy_n(predictions + offset, size, chunk.predictions.begin());
+        std::copy_n(labels + offset, size, chunk.labels.begin());
+        ++queued;
+        available.notify_one();
+    }
+}
+
+bool PredictionLogWriter::close() {
+    if (file == nullptr) {
+        return !failed;
+    }
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        closing = true;
+    }
+    available.notify_one();
+    writerThread.join();
+    if (std::fclose(file) != 0) {
+        failed = true;
+    }
+    file = nullptr;
+    return !failed;
+}
+
+void PredictionLogWriter::run() {
+    std::unique_lock<std::mutex> lock(mutex);
+    while (true) {
+        available.wait(lock, [this] { return closing || queued > 0; });
+        if (queued == 0) {
+            break; // closing and drained
+        }
+        const Chunk& chunk = chunks[head];
+        lock.unlock();
+        format(chunk);
+        lock.lock();
+        head = (head + 1) % chunks.size();
+        --queued;
+        recycled.notify_one();
+    }
+    lock.unlock();
+    flushBlock();
+}
+
+void PredictionLogWriter::format(const Chunk& chunk) {
+    char number[16];
+    auto append = [&](int value) {
+        const auto result = std::to_chars(number, number + sizeof(number), value);
+        block.append(number, result.ptr);
+    };
+    for (int i = 0; i < chunk.count; ++i) {
+        const int image = chunk.firstImage + i;
+        if (image % batchSize == 0) {
+            block += "Current batch: ";
+            append(image / batchSize);
+            block += '\n';
+        }
+        block += " - image ";
+        append(image);
+        block += ": Prediction=";
+        append(chunk.predictions[i]);
+        block += ". Label=";
+        append(chunk.labels[i]);
+        block += '\n';
+        if (block.size() >= blockSize) {
+            flushBlock();
+        }
+    }
+}
+
+void PredictionLogWriter::flushBlock() {
+    if (!block.empty() && std::fwrite(block.data(), 1, block.size(), file) != block.size()) {
+        failed = true;
+    }
+    block.clear();
+}
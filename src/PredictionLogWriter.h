@@ -0,0 +1,72 @@
+#ifndef PERCEPTRON_PREDICTIONLOGWRITER_H
+#define PERCEPTRON_PREDICTIONLOGWRITER_H
+
+#pragma once
+
+#include <condition_variable>
+#include <cstdio>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+// Writes the prediction log on a background thread. The caller hands over predictions and labels for a run of
+// consecutive images; the writer thread formats them into large blocks and writes each block with a single call,
+// so neither formatting nor I/O sits on the evaluation path. Results are handed over in a fixed pool of chunks
+// allocated up front; when all of them wait for the writer, write() blocks until one is recycled, so memory stays
+// bounded however far evaluation runs ahead of the disk.
+class PredictionLogWriter {
+public:
+    // Opens the log; check isOpen() before writing. Images are grouped into "Current batch" sections of batchSize.
+    // Each chunk holds chunkSize images; larger writes are split across chunks.
+    PredictionLogWriter(const std::string& path, int batchSize, int chunkSize);
+
+    // Flushes and closes the log
+    ~PredictionLogWriter();
+
+    PredictionLogWriter(const PredictionLogWriter& other) = delete;
+    PredictionLogWriter& operator=(const PredictionLogWriter& other) = delete;
+
+    [[nodiscard]] bool isOpen() const { return file != nullptr; }
+
+    // Queues the results of images firstImage, firstImage + 1, ..., firstImage + count - 1, waiting for a free
+    // chunk if all are queued.
+    void write(int firstImage, const int* predictions, const int* labels, int count);
+
+    // Writes everything queued so far and closes the file. Returns false if any write failed.
+    bool close();
+
+private:
+    struct Chunk {
+        int firstImage = 0;
+        int count = 0;
+        std::vector<int> predictions;
+        std::vector<int> labels;
+    };
+
+    // Worker loop that formats queued chunks and writes full blocks
+    void run();
+
+    void format(const Chunk& chunk);
+
+    void flushBlock();
+
+    static constexpr std::size_t blockSize = 1 << 20;
+    static constexpr std::size_t chunkCount = 4;
+
+    std::FILE* file = nullptr;
+    int batchSize;
+    std::thread writerThread;
+    std::mutex mutex;
+    std::condition_variable available; // A chunk was queued or the log is closing
+    std::condition_variable recycled;  // The writer finished a chunk
+    // Ring of chunkCount chunks; the queued ones are [head, head + queued), the writer formats the one at head
+    std::vector<Chunk> chunks;
+    std::size_t head = 0;
+    std::size_t queued = 0;
+    bool closing = false;
+    bool failed = false;
+    std::string block;
+};
+
+#endif //PERCEPTRON_PREDICTIONLOGWRITER_H
@@ -0,0 +1,141 @@
+#ifndef PERCEPTRON_RNG_H
+#define PERCEPTRON_RNG_H
+
+#pragma once
+
+#include <Eigen/Dense>
+#include <algorithm>
+#include <cstdint>
+#include <limits>
+#include <thread>
+#include <vector>
+
+// Counter-based random numbers. A Stream is a key; its i-th value is a pure function of key and i (the SplitMix64
+// output for state key + i * gamma), so any element can be drawn without generating the ones before it. Threads
+// can fill disjoint ranges of one stream and get the same numbers as a single thread, and split() derives
+// independent streams, e.g. one per layer, epoch or worker, from a config seed without shared mutable state.
+#if (defined(__x86_64__) || defined(__i386__)) && (defined(__GNUC__) || defined(__clang__))
+#define PERCEPTRON_RNG_AVX512 1
+#endif
+
+namespace Rng {
+    inline constexpr std::uint64_t gamma = 0x9e3779b97f4a7c15ULL;
+
+    // Seed of runs that do not configure one
+    inline constexpr std::uint64_t defaultSeed = 23405559;
+
+    // SplitMix64 finalizer, a bijection on 64-bit values
+    inline constexpr std::uint64_t mix(std::uint64_t x) {
+        x = (x ^ (x >> 30)) * 0xbf58476d1ce4e5b9ULL;
+        x = (x ^ (x >> 27)) * 0x94d049bb133111ebULL;
+        return x ^ (x >> 31);
+    }
+
+    // Top-level streams of a run; further split by layer, epoch or worker.
+    enum class Purpose : std::uint64_t {
+        Initialization = 1,
+        Shuffle = 2
+    };
+
+    class Stream {
+    public:
+        explicit constexpr Stream(std::uint64_t seed) : key(mix(seed)) {}
+
+        // Independent stream identified by id
+        [[nodiscard]] constexpr Stream split(std::uint64_t id) const {
+            return Stream(mix(key ^ mix(id + gamma)));
+        }
+
+        [[nodiscard]] constexpr Stream split(Purpose purpose) const {
+            return split(static_cast<std::uint64_t>(purpose));
+        }
+
+        // Value number counter of the stream
+        [[nodiscard]] constexpr std::uint64_t at(std::uint64_t counter) const {
+            return mix(key + (counter + 1) * gamma);
+        }
+
+        // Value number counter mapped to [0, bound) by a 64 x 64 -> 128-bit multiply; the bias is below
+        // bound / 2^64.
+        [[nodiscard]] std::uint64_t below(std::uint64_t counter, std::uint64_t bound) const {
+            return static_cast<std::uint64_t>((static_cast<unsigned __int128>(at(counter)) * bound) >> 64);
+        }
+
+        // Value number counter mapped to [-1, 1) with the full mantissa of T
+        template<typename T>
+        [[nodiscard]] T symmetric(std::uint64_t counter) const {
+            return toSymmetric<T>(at(counter));
+        }
+
+        // Writes symmetric(first + i) * scale to out[i] for i in [0, count). The values are independent, so CPUs
+        // with AVX-512DQ generate eight per instruction with 64-bit vector multiplies; the result is the same on
+        // every CPU because all conversions are exact and the only rounding is the multiply by scale.
+        template<typename T>
+        void symmetric(std::uint64_t first, std::size_t count, T scale, T *out) const {
+#ifdef PERCEPTRON_RNG_AVX512
+            if (__builtin_cpu_supports("avx512dq")) {
+                symmetricAvx512(first, count, scale, out);
+                return;
+            }
+#endif
+            for (std::size_t i = 0; i < count; ++i) {
+                out[i] = symmetric<T>(first + i) * scale;
+            }
+        }
+
+    private:
+        std::uint64_t key;
+
+        template<typename T>
+        static T toSymmetric(std::uint64_t value) {
+            constexpr int bits = std::numeric_limits<T>::digits;
+            // Through int64 so the conversion has a single vector instruction; the value fits in bits bits anyway
+            const auto integer = static_cast<std::int64_t>(value >> (64 - bits));
+            const auto unit = static_cast<T>(integer) * (T(1) / static_cast<T>(1ULL << bits));
+            return unit * T(2) - T(1);
+        }
+
+#ifdef PERCEPTRON_RNG_AVX512
+        // The loop of symmetric() compiled for AVX-512DQ; only called after the CPU check
+        template<typename T>
+        __attribute__((target("avx512f,avx512dq")))
+        void symmetricAvx512(std::uint64_t first, std::size_t count, T scale, T *out) const {
+            for (std::size_t i = 0; i < count; ++i) {
+                out[i] = toSymmetric<T>(mix(key + (first + i + 1) * gamma)) * scale;
+            }
+        }
+#endif
+    };
+
+    // Fills m with values uniform in [-scale, scale), entry i in storage order taking value i of stream. Large
+    // matrices are split into contiguous ranges across hardware threads, each filled by the vectorized
+    // Stream::symmetric; the result does not depend on the split.
+    template<typename Derived>
+    void fillSymmetric(Eigen::PlainObjectBase<Derived> &m, const Stream &stream, typename Derived::Scalar scale) {
+        using Scalar = typename Derived::Scalar;
+        constexpr Eigen::Index minRangeSize = 1 << 18;
+        Scalar *data = m.data();
+        const Eigen::Index size = m.size();
+        auto fill = [&](Eigen::Index begin, Eigen::Index end) {
+            stream.symmetric(static_cast<std::uint64_t>(begin), static_cast<std::size_t>(end - begin), scale,
+                             data + begin);
+        };
+        const auto threadCount = static_cast<Eigen::Index>(
+                std::min<Eigen::Index>(std::max(1U, std::thread::hardware_concurrency()), size / minRangeSize));
+        if (threadCount <= 1) {
+            fill(0, size);
+            return;
+        }
+        std::vector<std::thread> threads;
+        threads.reserve(threadCount - 1);
+        for (Eigen::Index t = 1; t < threadCount; ++t) {
+            threads.emplace_back(fill, size * t / threadCount, size * (t + 1) / threadCount);
+        }
+        fill(0, size / threadCount);
+        for (auto &thread : threads) {
+            thread.join();
+        }
+    }
+}
+
+#endif //PERCEPTRON_RNG_H
@@ -0,0 +1,351 @@
+#ifndef PERCEPTRON_INFERENCESERVER_H
+#define PERCEPTRON_INFERENCESERVER_H
+
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <charconv>
+#include <chrono>
+#include <condition_variable>
+#include <cstdio>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+#include <unistd.h>
+#include "../Network/Components.h"
+#include "../Network/Quantized.h"
+#include "LatencyHistogram.h"
+
+// Completion signal shared by all requests of a session. `done` of those requests is only read or written under
+// the mutex, so once the session has seen a request done the batcher has released the mutex and is no longer
+// touching the request or the session.
+struct InferenceCompletion {
+    std::mutex mutex;
+    std::condition_variable finished;
+};
+
+// Classification request of one image. Sessions own their requests and reuse them; the batcher only fills in the
+// prediction and marks them done.
+struct InferenceRequest {
+    enum class Kind { Classify, Stats, Invalid };
+
+    std::vector<unsigned char> pixels;
+    Kind kind = Kind::Classify;
+    int prediction = -1;
+    std::chrono::steady_clock::time_point arrival;
+    InferenceCompletion *completion = nullptr;
+    bool done = false; // Guarded by completion->mutex
+};
+
+// Collects requests from any number of sessions into micro-batches and classifies each batch with one
+// Network::forward call on a dedicated thread. A batch is started as soon as maxBatch requests are waiting or the
+// oldest waiting request is maxWait old, so light load sees at most maxWait of extra latency while heavy load gets
+// full batches. The latency from submission to completion of every request goes into a histogram. With a quantized
+// network, batches are classified by its int8 kernels straight from the request pixels instead.
+template<typename T>
+class DynamicBatcher {
+public:
+    DynamicBatcher(const Network<T> &network, int maxBatch, std::chrono::microseconds maxWait,
+                   const QuantizedNetwork *quantized = nullptr)
+            : network(network), quantized(quantized), maxBatch(maxBatch), maxWait(maxWait),
+              workspace(network.makeWorkspace(maxBatch)) {
+        if (quantized) {
+            quantizedWorkspace = quantized->makeWorkspace(maxBatch);
+            pixels.resize(static_cast<std::size_t>(maxBatch) * inputSize());
+        } else {
+            images.reserve(static_cast<Eigen::Index>(maxBatch) * inputSize());
+        }
+        batch.reserve(maxBatch);
+        worker = std::thread(&DynamicBatcher::run, this);
+    }
+
+    DynamicBatcher(const DynamicBatcher &other) = delete;
+    DynamicBatcher &operator=(const DynamicBatcher &other) = delete;
+
+    ~DynamicBatcher() {
+        {
+            std::lock_guard lock(mutex);
+            stopping = true;
+        }
+        wakeup.notify_one();
+        worker.join();
+    }
+
+    [[nodiscard]] int inputSize() const { return static_cast<int>(network.layer(0).inputSize()); }
+
+    void submit(InferenceRequest &request) {
+        request.arrival = std::chrono::steady_clock::now();
+        std::size_t waiting;
+        {
+            std::lock_guard lock(mutex);
+            pending.push_back(&request);
+            waiting = pending.size();
+        }
+        // The batcher only needs to wake up for the first request of a batch and when the batch is full
+        if (waiting == 1 || waiting >= static_cast<std::size_t>(maxBatch)) {
+            wakeup.notify_one();
+        }
+    }
+
+    // One line with request count, throughput, batch size and latency percentiles in microseconds.
+    [[nodiscard]] std::string stats() const {
+        const double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - started).count();
+        const std::uint64_t requests = latencies.count();
+        std::atomic_thread_fence(std::memory_order_acquire);
+        const std::uint64_t batchCount = batches.load(std::memory_order_relaxed);
+        char line[256];
+        std::snprintf(line, sizeof(line),
+                      "requests=%llu throughput=%.0f/s mean_batch=%.1f latency_us mean=%.1f p50=%.1f p90=%.1f "
+                      "p99=%.1f p99.9=%.1f",
+                      static_cast<unsigned long long>(requests), seconds > 0 ? requests / seconds : 0.0,
+                      batchCount > 0 ? static_cast<double>(requests) / static_cast<double>(batchCount) : 0.0,
+                      latencies.mean() * 1e-3, latencies.percentile(0.5) * 1e-3, latencies.percentile(0.9) * 1e-3,
+                      latencies.percentile(0.99) * 1e-3, latencies.percentile(0.999) * 1e-3);
+        return line;
+    }
+
+private:
+    const Network<T> &network;
+    const QuantizedNetwork *quantized;
+    int maxBatch;
+    std::chrono::microseconds maxWait;
+    typename Network<T>::Workspace workspace;
+    Buffer<T> images;
+    QuantizedNetwork::Workspace quantizedWorkspace;
+    std::vector<std::uint8_t> pixels; // Raw pixels of a batch for the quantized network
+    std::vector<InferenceRequest *> batch;
+    std::mutex mutex;
+    std::condition_variable wakeup;
+    std::deque<InferenceRequest *> pending;
+    bool stopping = false;
+    LatencyHistogram latencies;
+    std::atomic<std::uint64_t> batches{0};
+    std::chrono::steady_clock::time_point started = std::chrono::steady_clock::now();
+    std::thread worker;
+
+    void run() {
+        std::unique_lock lock(mutex);
+        while (true) {
+            wakeup.wait(lock, [this] { return stopping || !pending.empty(); });
+            if (pending.empty()) {
+                return;
+            }
+            const auto deadline = pending.front()->arrival + maxWait;
+            wakeup.wait_until(lock, deadline, [this] {
+                return stopping || pending.size() >= static_cast<std::size_t>(maxBatch);
+            });
+            const std::size_t count = std::min(pending.size(), static_cast<std::size_t>(maxBatch));
+            batch.assign(pending.begin(), pending.begin() + static_cast<std::ptrdiff_t>(count));
+            pending.erase(pending.begin(), pending.begin() + static_cast<std::ptrdiff_t>(count));
+            lock.unlock();
+            classify();
+            lock.lock();
+        }
+    }
+
+    void classify() {
+        const auto rows = static_cast<Eigen::Index>(batch.size());
+        if (quantized) {
+            for (Eigen::Index i = 0; i < rows; ++i) {
+                std::copy(batch[i]->pixels.begin(), batch[i]->pixels.end(), pixels.begin() + i * inputSize());
+            }
+            complete(quantized->forward(pixels.data(), static_cast<int>(rows), quantizedWorkspace));
+            return;
+        }
+        auto input = images.view(rows, inputSize());
+        for (Eigen::Index i = 0; i < rows; ++i) {
+            const Eigen::Map<const Eigen::Matrix<unsigned char, 1, Eigen::Dynamic>> raw(batch[i]->pixels.data(),
+                                                                                      inputSize());
+            input.row(i) = raw.template cast<T>() / static_cast<T>(255.0);
+        }
+        complete(network.forward(input, workspace));
+    }
+
+    // Hands the predictions of the batch to its requests.
+    template<typename Logits>
+    void complete(const Logits &logits) {
+        const auto rows = static_cast<Eigen::Index>(batch.size());
+        const auto finished = std::chrono::steady_clock::now();
+        // Counted before the requests, so stats() never sees them without their batch; the fence pairs with the
+        // one in stats()
+        batches.fetch_add(1, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_release);
+        for (Eigen::Index i = 0; i < rows; ++i) {
+            Eigen::Index prediction;
+            logits.row(i).maxCoeff(&prediction);
+            InferenceRequest &request = *batch[i];
+            request.prediction = static_cast<int>(prediction);
+            latencies.record(static_cast<std::uint64_t>(
+                    std::chrono::duration_cast<std::chrono::nanoseconds>(finished - request.arrival).count()));
+            // Notify while holding the mutex: the session may reuse the slot or go away as soon as it sees done
+            std::lock_guard lock(request.completion->mutex);
+            request.done = true;
+            request.completion->finished.notify_one();
+        }
+    }
+};
+
+// Serves one client stream of newline-separated requests and writes one response line per request, in order.
+// A request is the image as inputSize comma- or space-separated pixel values 0-255, answered with the predicted
+// digit, or "stats", answered with the batcher statistics. The calling thread reads and submits requests while a
+// second thread writes the responses, so a single client can pipeline up to `window` requests and still have
+// them batched together.
+template<typename T>
+class InferenceSession {
+public:
+    InferenceSession(DynamicBatcher<T> &batcher, int inputFd, int outputFd, int window)
+            : batcher(batcher), inputFd(inputFd), outputFd(outputFd), slots(std::max(window, 1)) {
+        for (auto &slot : slots) {
+            slot.pixels.resize(batcher.inputSize());
+            slot.completion = &completion;
+        }
+    }
+
+    // Returns when the input is exhausted and every response has been written.
+    void run() {
+        std::thread writer(&InferenceSession::write, this);
+        read();
+        writer.join();
+    }
+
+private:
+    DynamicBatcher<T> &batcher;
+    int inputFd;
+    int outputFd;
+    InferenceCompletion completion;
+    std::vector<InferenceRequest> slots;
+    std::atomic<std::uint64_t> submitted{0};
+    std::atomic<std::uint64_t> written{0};
+    std::atomic<bool> finished{false};
+
+    void read() {
+        std::string buffer;
+        std::size_t begin = 0;
+        char chunk[65536];
+        std::uint64_t next = 0;
+        while (true) {
+            const std::size_t end = buffer.find('\n', begin);
+            if (end == std::string::npos) {
+                buffer.erase(0, begin);
+                begin = 0;
+                const ssize_t bytes = ::read(inputFd, chunk, sizeof(chunk));
+                if (bytes <= 0) {
+                    break;
+                }
+                buffer.append(chunk, static_cast<std::size_t>(bytes));
+                continue;
+            }
+            std::string_view line(buffer.data() + begin, end - begin);
+            begin = end + 1;
+            if (!line.empty() && line.back() == '\r') {
+                line.remove_suffix(1);
+            }
+            if (line.empty()) {
+                continue;
+            }
+
+            // Wait until the writer has handed the slot back
+            std::uint64_t done = written.load(std::memory_order_acquire);
+            while (next - done >= slots.size()) {
+                written.wait(done, std::memory_order_acquire);
+                done = written.load(std::memory_order_acquire);
+            }
+            InferenceRequest &request = slots[next % slots.size()];
+            request.kind = parse(line, request.pixels) ? InferenceRequest::Kind::Classify
+                                                       : line == "stats" ? InferenceRequest::Kind::Stats
+                                                                         : InferenceRequest::Kind::Invalid;
+            if (request.kind == InferenceRequest::Kind::Classify) {
+                batcher.submit(request);
+            } else {
+                std::lock_guard lock(completion.mutex);
+                request.done = true;
+            }
+            submitted.store(++next, std::memory_order_release);
+            submitted.notify_one();
+        }
+        finished.store(true, std::memory_order_release);
+        submitted.notify_one();
+    }
+
+    void write() {
+        std::string output;
+        for (std::uint64_t i = 0;; ++i) {
+            std::uint64_t available = submitted.load(std::memory_order_acquire);
+            while (available == i) {
+                if (finished.load(std::memory_order_acquire) && submitted.load(std::memory_order_acquire) == i) {
+                    flush(output);
+                    return;
+                }
+                // Nothing to do until the reader submits more; send what is ready first
+                flush(output);
+                submitted.wait(available, std::memory_order_acquire);
+                available = submitted.load(std::memory_order_acquire);
+            }
+            InferenceRequest &request = slots[i % slots.size()];
+            {
+                std::unique_lock lock(completion.mutex);
+                if (!request.done) {
+                    lock.unlock();
+                    flush(output);
+                    lock.lock();
+                    completion.finished.wait(lock, [&request] { return request.done; });
+                }
+                request.done = false;
+            }
+            switch (request.kind) {
+                case InferenceRequest::Kind::Classify:
+                    output += static_cast<char>('0' + request.prediction);
+                    break;
+                case InferenceRequest::Kind::Stats:
+                    output += batcher.stats();
+                    break;
+                case InferenceRequest::Kind::Invalid:
+                    output += "error: expected " + std::to_string(batcher.inputSize()) + " pixel values 0-255";
+                    break;
+            }
+            output += '\n';
+            written.store(i + 1, std::memory_order_release);
+            written.notify_one();
+        }
+    }
+
+    void flush(std::string &output) {
+        std::size_t offset = 0;
+        while (offset < output.size()) {
+            const ssize_t bytes = ::write(outputFd, output.data() + offset, output.size() - offset);
+            if (bytes <= 0) {
+                break; // Client went away; keep draining so the reader is not blocked
+            }
+            offset += static_cast<std::size_t>(bytes);
+        }
+        output.clear();
+    }
+
+    // Parses exactly pixels.size() values 0-255 separated by commas and/or spaces.
+    static bool parse(std::string_view line, std::vector<unsigned char> &pixels) {
+        const char *position = line.data();
+        const char *end = line.data() + line.size();
+        for (auto &pixel : pixels) {
+            while (position < end && (*position == ' ' || *position == ',' || *position == '\t')) {
+                ++position;
+            }
+            unsigned value = 0;
+            const auto [next, error] = std::from_chars(position, end, value);
+            if (error != std::errc() || value > 255) {
+                return false;
+            }
+            pixel = static_cast<unsigned char>(value);
+            position = next;
+        }
+        while (position < end && (*position == ' ' || *position == ',' || *position == '\t')) {
+            ++position;
+        }
+        return position == end;
+    }
+};
+
+#endif //PERCEPTRON_INFERENCESERVER_H
@@ -0,0 +1,74 @@
+#ifndef PERCEPTRON_LATENCYHISTOGRAM_H
+#define PERCEPTRON_LATENCYHISTOGRAM_H
+
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <bit>
+#include <cstdint>
+
+// Log-linear histogram of nanosecond latencies: every power of two is split into 8 buckets, so a reported
+// percentile is at most 12.5% above the true value while memory stays fixed. One thread records; any thread may
+// read percentiles concurrently.
+class LatencyHistogram {
+public:
+    void record(std::uint64_t nanoseconds) {
+        auto &bucket = counts[index(nanoseconds)];
+        bucket.store(bucket.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+        total.store(total.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+        sum.store(sum.load(std::memory_order_relaxed) + nanoseconds, std::memory_order_relaxed);
+    }
+
+    [[nodiscard]] std::uint64_t count() const { return total.load(std::memory_order_relaxed); }
+
+    [[nodiscard]] double mean() const {
+        const std::uint64_t n = count();
+        return n > 0 ? static_cast<double>(sum.load(std::memory_order_relaxed)) / static_cast<double>(n) : 0.0;
+    }
+
+    // Upper bound of the bucket holding the given fraction of all recorded values, e.g. 0.99 for p99.
+    [[nodiscard]] std::uint64_t percentile(double fraction) const {
+        const std::uint64_t n = count();
+        if (n == 0) {
+            return 0;
+        }
+        const auto target = std::max<std::uint64_t>(1, static_cast<std::uint64_t>(fraction * static_cast<double>(n)));
+        std::uint64_t seen = 0;
+        for (int i = 0; i < bucketCount; ++i) {
+            seen += counts[i].load(std::memory_order_relaxed);
+            if (seen >= target) {
+                return i + 1 < bucketCount ? lowerBound(i + 1) - 1 : lowerBound(i);
+            }
+        }
+        return lowerBound(bucketCount - 1);
+    }
+
+private:
+    static constexpr int subBits = 3;
+    static constexpr int subBuckets = 1 << subBits;
+    static constexpr int bucketCount = 64 * subBuckets;
+
+    std::array<std::atomic<std::uint64_t>, bucketCount> counts{};
+    std::atomic<std::uint64_t> total{0};
+    std::atomic<std::uint64_t> sum{0};
+
+    static int index(std::uint64_t value) {
+        if (value < subBuckets) {
+            return static_cast<int>(value);
+        }
+        const int msb = std::bit_width(value) - 1;
+        return (msb - subBits + 1) * subBuckets + static_cast<int>((value >> (msb - subBits)) & (subBuckets - 1));
+    }
+
+    static std::uint64_t lowerBound(int index) {
+        if (index < subBuckets) {
+            return static_cast<std::uint64_t>(index);
+        }
+        const int msb = index / subBuckets + subBits - 1;
+        return (std::uint64_t{1} << msb) + (static_cast<std::uint64_t>(index % subBuckets) << (msb - subBits));
+    }
+};
+
+#endif //PERCEPTRON_LATENCYHISTOGRAM_H
@@ -0,0 +1,107 @@
+#ifndef PERCEPTRON_SWEEP_H
+#define PERCEPTRON_SWEEP_H
+
+#pragma once
+
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <utility>
+#include <vector>
+#include "../DataHandling.h"
+
+// Expansion of a sweep file into the configs of a hyperparameter grid. A sweep file is a regular config file in
+// which any value may list alternatives separated by '|', e.g. "learning_rate = 0.001 | 0.01 | 0.1"; the grid is
+// the cartesian product of all such keys, in file order with the last key varying fastest.
+namespace Sweep {
+    struct Point {
+        Utils::Config config;
+        // The swept keys and this point's values, in file order
+        std::vector<std::pair<std::string, std::string>> values;
+    };
+
+    // Keys that select the shared dataset, precision and compute backend; they cannot differ between the points
+    // of a sweep.
+    inline bool isSharedKey(const std::string& key) {
+        return key == "precision" || key == "compute_backend" || key.rfind("rel_path_train_", 0) == 0 ||
+               key.rfind("rel_path_test_", 0) == 0;
+    }
+
+    inline std::string trim(std::string text) {
+        text.erase(0, text.find_first_not_of(" \t"));
+        text.erase(text.find_last_not_of(" \t") + 1);
+        return text;
+    }
+
+    // Returns the points of the grid described by the sweep file, or an empty vector after printing an error.
+    inline std::vector<Point> expand(const std::string& filename) {
+        std::ifstream file(filename);
+        if (!file.is_open()) {
+            std::cerr << "Error opening file: " << filename << std::endl;
+            return {};
+        }
+
+        // Fixed lines are passed through; swept keys are replaced by one alternative per point
+        struct Axis {
+            std::size_t line;
+            std::string key;
+            std::vector<std::string> alternatives;
+        };
+        std::vector<std::string> lines;
+        std::vector<Axis> axes;
+        std::string line;
+        while (std::getline(file, line)) {
+            const std::size_t equals = line.find('=');
+            if (!line.empty() && line[0] != '#' && equals != std::string::npos &&
+                line.find('|', equals) != std::string::npos) {
+                Axis axis{lines.size(), trim(line.substr(0, equals)), {}};
+                std::istringstream alternatives(line.substr(equals + 1));
+                std::string alternative;
+                while (std::getline(alternatives, alternative, '|')) {
+                    if (!trim(alternative).empty()) {
+                        axis.alternatives.push_back(trim(alternative));
+                    }
+                }
+                if (isSharedKey(axis.key)) {
+                    std::cerr << "Cannot sweep " << axis.key << ": all configs of a sweep share one dataset, "
+                              << "precision and compute backend" << std::endl;
+                    return {};
+                }
+                if (axis.alternatives.empty()) {
+                    std::cerr << "No values for swept key " << axis.key << std::endl;
+                    return {};
+                }
+                axes.push_back(std::move(axis));
+            }
+            lines.push_back(line);
+        }
+
+        std::size_t count = 1;
+        for (const auto& axis : axes) {
+            count *= axis.alternatives.size();
+        }
+        std::vector<Point> points(count);
+        for (std::size_t p = 0; p < count; ++p) {
+            std::vector<std::string> concrete = lines;
+            std::size_t index = p;
+            for (std::size_t a = axes.size(); a-- > 0;) {
+                const Axis& axis = axes[a];
+                const std::string& value = axis.alternatives[index % axis.alternatives.size()];
+                index /= axis.alternatives.size();
+                concrete[axis.line] = axis.key + " = " + value;
+                points[p].values.insert(points[p].values.begin(), {axis.key, value});
+            }
+            std::stringstream text;
+            for (const auto& concreteLine : concrete) {
+                text << concreteLine << '\n';
+            }
+            if (!Utils::parseConfig(text, points[p].config)) {
+                std::cerr << "Invalid sweep point " << p << std::endl;
+                return {};
+            }
+        }
+        return points;
+    }
+}
+
+#endif //PERCEPTRON_SWEEP_H
@@ -0,0 +1,182 @@
+#ifndef PERCEPTRON_BATCHPIPELINE_H
+#define PERCEPTRON_BATCHPIPELINE_H
+
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <exception>
+#include <numeric>
+#include <thread>
+#include <vector>
+#include "../DataHandling.h"
+#include "../Metrics/Trace.h"
+#include "../Network/Workspace.h"
+#include "../Random/Rng.h"
+
+// Order in which an epoch visits the training set: file order, or a permutation that depends only on the
+// seed and the epoch. The Fisher-Yates shuffle draws from the epoch's own counter-based stream.
+inline void epochOrder(int count, bool shuffle, std::uint64_t seed, int epoch, std::vector<int> &order) {
+    order.resize(count);
+    std::iota(order.begin(), order.end(), 0);
+    if (shuffle) {
+        const Rng::Stream stream = Rng::Stream(seed).split(Rng::Purpose::Shuffle).split(epoch);
+        for (int i = count - 1; i > 0; --i) {
+            std::swap(order[i], order[stream.below(i, static_cast<std::uint64_t>(i) + 1)]);
+        }
+    }
+}
+
+// Prepares mini-batches on a background thread. For every epoch the producer draws the visiting order, gathers and
+// normalizes the next batches from the mapped loader into a ring of preallocated slots and publishes them through
+// a bounded single-producer/single-consumer queue built on two atomic counters. The trainer takes batches with
+// acquire() and hands the slot back with release(), so data preparation overlaps with compute.
+// With parts > 1 the pipeline only prepares slice part of every batch, rows [batchRows * part / parts,
+// batchRows * (part + 1) / parts); this is how the worker processes of distributed training split each batch.
+template<typename T>
+class BatchPipeline {
+public:
+    struct Batch {
+        Buffer<T> images;
+        Buffer<T> labels;
+        int rows = 0;      // Rows of this slice
+        int batchRows = 0; // Rows of the whole batch
+        int epoch = 0;
+    };
+
+    // Produces the batches of epochs [firstEpoch, endEpoch).
+    BatchPipeline(const MNISTLoader<T> &loader, int batchSize, int firstEpoch, int endEpoch, int depth, bool shuffle,
+                  std::uint64_t seed, int part = 0, int parts = 1)
+            : loader(loader), batchSize(batchSize), firstEpoch(firstEpoch), endEpoch(endEpoch), shuffle(shuffle),
+              seed(seed), part(part), parts(parts),
+              slots(std::max(depth, 2)) {
+        const int sliceRows = (batchSize + parts - 1) / parts;
+        for (auto &slot : slots) {
+            slot.images.reserve(static_cast<Eigen::Index>(sliceRows) * loader.imageSize());
+            slot.labels.reserve(static_cast<Eigen::Index>(sliceRows) * classes);
+        }
+        producer = std::thread(&BatchPipeline::produce, this);
+    }
+
+    BatchPipeline(const BatchPipeline &other) = delete;
+    BatchPipeline &operator=(const BatchPipeline &other) = delete;
+
+    ~BatchPipeline() {
+        stopping.store(true, std::memory_order_release);
+        // Pretend every slot was handed back so a producer waiting for space wakes up and sees the stop flag
+        consumed.fetch_add(slots.size(), std::memory_order_release);
+        consumed.notify_one();
+        producer.join();
+    }
+
+    [[nodiscard]] int batchesPerEpoch() const { return (loader.imageCount() + batchSize - 1) / batchSize; }
+
+    // Rows of one epoch that slice part of parts receives.
+    [[nodiscard]] static long long sliceRowsPerEpoch(int rows, int batchSize, int part, int parts) {
+        long long total = 0;
+        for (int first = 0; first < rows; first += batchSize) {
+            const int batchRows = std::min(batchSize, rows - first);
+            total += batchRows * (part + 1) / parts - batchRows * part / parts;
+        }
+        return total;
+    }
+
+    // Blocks until the next batch is ready. The batch stays valid until release().
+    const Batch &acquire() {
+        const auto start = std::chrono::steady_clock::now();
+        std::uint64_t ready = produced.load(std::memory_order_acquire);
+        while (ready == taken) {
+            produced.wait(ready, std::memory_order_acquire);
+            ready = produced.load(std::memory_order_acquire);
+        }
+        if (failed.load(std::memory_order_acquire)) {
+            std::rethrow_exception(error);
+        }
+        waiting += std::chrono::steady_clock::now() - start;
+        return slots[taken % slots.size()];
+    }
+
+    void release() {
+        ++taken;
+        consumed.store(taken, std::memory_order_release);
+        consumed.notify_one();
+    }
+
+    // Views of the acquired batch.
+    [[nodiscard]] typename Buffer<T>::ConstView images(const Batch &batch) const {
+        return batch.images.view(batch.rows, loader.imageSize());
+    }
+
+    [[nodiscard]] typename Buffer<T>::ConstView labels(const Batch &batch) const {
+        return batch.labels.view(batch.rows, classes);
+    }
+
+    // Time the consumer spent blocked in acquire(), i.e. data preparation that was not hidden behind compute.
+    [[nodiscard]] std::chrono::steady_clock::duration waitTime() const { return waiting; }
+
+private:
+    static constexpr int classes = 10;
+
+    const MNISTLoader<T> &loader;
+    int batchSize;
+    int firstEpoch;
+    int endEpoch;
+    bool shuffle;
+    std::uint64_t seed;
+    int part;
+    int parts;
+    std::vector<Batch> slots;
+    std::thread producer;
+    std::atomic<std::uint64_t> produced{0};
+    std::atomic<std::uint64_t> consumed{0};
+    std::atomic<bool> stopping{false};
+    std::atomic<bool> failed{false};
+    std::exception_ptr error;
+    std::uint64_t taken = 0; // Consumer-side copy of consumed
+    std::chrono::steady_clock::duration waiting{};
+
+    void produce() {
+        TRACE_THREAD_NAME("BatchPipeline");
+        try {
+            std::vector<int> order;
+            std::uint64_t next = 0;
+            for (int epoch = firstEpoch; epoch < endEpoch; ++epoch) {
+                epochOrder(loader.imageCount(), shuffle, seed, epoch, order);
+                for (int first = 0; first < loader.imageCount(); first += batchSize) {
+                    // Wait for a free slot
+                    std::uint64_t done = consumed.load(std::memory_order_acquire);
+                    while (next - done >= slots.size() && !stopping.load(std::memory_order_acquire)) {
+                        consumed.wait(done, std::memory_order_acquire);
+                        done = consumed.load(std::memory_order_acquire);
+                    }
+                    if (stopping.load(std::memory_order_acquire)) {
+                        return;
+                    }
+
+                    Batch &slot = slots[next % slots.size()];
+                    slot.batchRows = std::min(batchSize, loader.imageCount() - first);
+                    const int begin = first + slot.batchRows * part / parts;
+                    slot.rows = first + slot.batchRows * (part + 1) / parts - begin;
+                    slot.epoch = epoch;
+                    TRACE_SCOPE("batch_copy");
+                    auto images = slot.images.view(slot.rows, loader.imageSize());
+                    auto labels = slot.labels.view(slot.rows, classes);
+                    loader.gatherImageBatch(order.data() + begin, slot.rows, images);
+                    loader.gatherLabelBatch(order.data() + begin, slot.rows, labels);
+
+                    produced.store(++next, std::memory_order_release);
+                    produced.notify_one();
+                }
+            }
+        } catch (...) {
+            error = std::current_exception();
+            failed.store(true, std::memory_order_release);
+            produced.fetch_add(1, std::memory_order_release);
+            produced.notify_one();
+        }
+    }
+};
+
+#endif //PERCEPTRON_BATCHPIPELINE_H
@@ -0,0 +1,234 @@
+#ifndef PERCEPTRON_DATAPARALLELTRAINER_H
+#define PERCEPTRON_DATAPARALLELTRAINER_H
+
+#pragma once
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <tuple>
+#include <utility>
+#include <vector>
+#include "../Distributed/RingAllReduce.h"
+#include "../Network/Components.h"
+#include "../Memory/AllocationCounter.h"
+#include "../Metrics/Trace.h"
+#include "../Metrics/TrainingMetrics.h"
+#include "../Parallel/ThreadPool.h"
+#include "TrainingReplica.h"
+
+// Synchronous data-parallel SGD with softmax cross-entropy loss. Every mini-batch is split into one contiguous
+// shard per thread; each thread runs forward/backward on its shard in its own workspace, then the shard
+// gradients are summed with a fixed pairwise tree so results are bit-reproducible for a given thread count.
+// With one thread this is exactly the single-threaded training step. If metrics are given, thread t reports to
+// metrics->thread(t), which must exist. With a ring, every worker process passes its slice of the global batch
+// and the reduced gradients, loss and row count are summed across processes before the update, so all processes
+// apply the same update to identical weights.
+template<typename T, typename Master = T>
+class DataParallelTrainer {
+public:
+    DataParallelTrainer(Network<T, Master> &network, int threadCount, int batchSize,
+                        Metrics::TrainingMetrics *metrics = nullptr, RingAllReduce *ring = nullptr)
+            : network(network), pool(threadCount), metrics(metrics), ring(ring) {
+        Eigen::initParallel();
+        const int shardSize = (batchSize + threadCount - 1) / threadCount;
+        replicas.reserve(threadCount);
+        for (int t = 0; t < threadCount; ++t) {
+            replicas.push_back({TrainingReplica<T, Master>(network, shardSize), 0, {}, {}});
+        }
+        if (ring && ring->worldSize() > 1) {
+            Eigen::Index size = 0;
+            for (std::size_t l = 0; l < network.layerCount(); ++l) {
+                const auto &gradients = replicas[0].state.workspace.gradients(l);
+                size += gradients.weights.size() + gradients.biases.size();
+            }
+            staging.resize(size);
+        }
+    }
+
+    // Runs one SGD step on the batch and returns the loss summed over its rows, or 0 if computeLoss is false. With
+    // a ring, images is this process's slice and the returned loss is summed over the whole batch.
+    double step(ConstMatrixRef<T> images, ConstMatrixRef<T> labels, Master learningRate, bool computeLoss = true) {
+        using Clock = std::chrono::steady_clock;
+        TRACE_SCOPE("step");
+        const auto stepStart = Clock::now();
+        const Memory::AllocationStats allocationsStart = Memory::threadAllocations();
+        const Eigen::Index rows = images.rows();
+        const int threadCount = pool.size();
+
+        pool.run([&](int t) {
+            const auto start = Clock::now();
+            const Memory::AllocationStats taskAllocations = Memory::threadAllocations();
+            Replica &replica = replicas[t];
+            const Eigen::Index begin = rows * t / threadCount;
+            const Eigen::Index count = rows * (t + 1) / threadCount - begin;
+            replica.lossSum = 0;
+            if (count > 0) {
+                replica.lossSum = replica.state.computeGradients(network, images.middleRows(begin, count),
+                                                                 labels.middleRows(begin, count), counters(t),
+                                                                 computeLoss);
+            } else {
+                for (std::size_t l = 0; l < network.layerCount(); ++l) {
+                    replica.state.workspace.gradients(l).weights.setZero();
+                    replica.state.workspace.gradients(l).biases.setZero();
+                }
+            }
+            if (threadCount > 1) {
+                if (t != 0) {
+                    replica.allocations += (Memory::threadAllocations() - taskAllocations);
+                }
+                replica.busy += Clock::now() - start;
+            }
+        });
+
+        if (threadCount > 1) {
+            pool.run([&](int t) {
+                const auto start = Clock::now();
+                Metrics::ScopedPhase phase(counters(t), Metrics::Phase::Reduce);
+                TRACE_SCOPE("reduce");
+                for (std::size_t l = 0; l < network.layerCount(); ++l) {
+                    reduceSlice(l, t, false);
+                    reduceSlice(l, t, true);
+                }
+                replicas[t].busy += Clock::now() - start;
+            });
+        }
+
+        double lossSum = 0;
+        for (const auto &replica : replicas) {
+            lossSum += replica.lossSum;
+        }
+        Eigen::Index batchRows = rows;
+        if (staging.size() > 0) {
+            Metrics::ScopedPhase phase(counters(0), Metrics::Phase::Reduce);
+            TRACE_SCOPE("allreduce");
+            std::tie(lossSum, batchRows) = reduceAcrossProcesses(lossSum, rows);
+        }
+
+        {
+            Metrics::ScopedPhase phase(counters(0), Metrics::Phase::Update);
+            auto &workspace = replicas[0].state.workspace;
+            network.normalizeGradients(workspace, batchRows);
+            network.updateWeights(learningRate, workspace);
+        }
+
+        const auto stepTime = Clock::now() - stepStart;
+        if (threadCount == 1) {
+            replicas[0].busy += stepTime;
+        }
+        Memory::AllocationStats stepAllocations = Memory::threadAllocations() - allocationsStart;
+        for (int t = 1; t < threadCount; ++t) {
+            stepAllocations += replicas[t].allocations;
+        }
+        if (steps > 0) {
+            steadyAllocations += stepAllocations;
+        }
+        for (auto &replica : replicas) {
+            replica.allocations = {};
+        }
+        if (metrics) {
+            Metrics::ThreadCounters &main = metrics->thread(0);
+            Metrics::ThreadCounters::add(main.samples, static_cast<std::uint64_t>(rows));
+            Metrics::ThreadCounters::add(main.batches, 1);
+            Metrics::ThreadCounters::add(main.allocations, stepAllocations.count);
+        }
+        ++steps;
+        samples += rows;
+        wallTime += stepTime;
+        return lossSum;
+    }
+
+    [[nodiscard]] int threadCount() const { return pool.size(); }
+
+    // Heap allocations made by all trainer threads during every step but the first.
+    [[nodiscard]] Memory::AllocationStats steadyStateAllocations() const { return steadyAllocations; }
+
+    // Steps after the first one
+    [[nodiscard]] long long steadyStateSteps() const { return std::max(steps - 1, 0LL); }
+
+    [[nodiscard]] double samplesPerSecond() const {
+        const double seconds = std::chrono::duration<double>(wallTime).count();
+        return seconds > 0 ? static_cast<double>(samples) / seconds : 0.0;
+    }
+
+    // Fraction of the available thread time (wall time x threads) spent computing inside steps; the rest is load
+    // imbalance, synchronization and the serial update. This is utilization, not scaling: threads that share
+    // cores stay busy while each one runs slower, so compare samplesPerSecond across thread counts for speedup.
+    [[nodiscard]] double busyFraction() const {
+        std::chrono::steady_clock::duration busy{};
+        for (const auto &replica : replicas) {
+            busy += replica.busy;
+        }
+        const double available = std::chrono::duration<double>(wallTime).count() * pool.size();
+        return available > 0 ? std::chrono::duration<double>(busy).count() / available : 0.0;
+    }
+
+private:
+    struct Replica {
+        TrainingReplica<T, Master> state;
+        double lossSum = 0;
+        std::chrono::steady_clock::duration busy{};
+        Memory::AllocationStats allocations;
+    };
+
+    Network<T, Master> &network;
+    ThreadPool pool;
+    Metrics::TrainingMetrics *metrics;
+    RingAllReduce *ring;
+    VectorT<T> staging; // Gradients summed across processes, packed for a single all-reduce
+    std::vector<Replica> replicas;
+    long long steps = 0;
+    long long samples = 0;
+    std::chrono::steady_clock::duration wallTime{};
+    Memory::AllocationStats steadyAllocations;
+
+    [[nodiscard]] Metrics::ThreadCounters *counters(int t) const { return metrics ? &metrics->thread(t) : nullptr; }
+
+    // Sums the gradients in replica 0, the loss and the row count over all processes; returns the summed loss and
+    // rows. The loss and row count are reduced in double precision whatever T is.
+    std::pair<double, Eigen::Index> reduceAcrossProcesses(double lossSum, Eigen::Index rows) {
+        auto &workspace = replicas[0].state.workspace;
+        auto pack = [&](bool unpack) {
+            Eigen::Index offset = 0;
+            for (std::size_t l = 0; l < network.layerCount(); ++l) {
+                auto &gradients = workspace.gradients(l);
+                for (auto [data, size] : {std::pair(gradients.weights.data(), gradients.weights.size()),
+                                          std::pair(gradients.biases.data(), gradients.biases.size())}) {
+                    Eigen::Map<VectorT<T>> flat(data, size);
+                    if (unpack) {
+                        flat = staging.segment(offset, size);
+                    } else {
+                        staging.segment(offset, size) = flat;
+                    }
+                    offset += size;
+                }
+            }
+        };
+        pack(false);
+        ring->allReduce(staging.data(), static_cast<std::size_t>(staging.size()));
+        pack(true);
+        double totals[2] = {lossSum, static_cast<double>(rows)};
+        ring->allReduce(totals, 2);
+        return {totals[0], static_cast<Eigen::Index>(std::llround(totals[1]))};
+    }
+
+    // Sums slice t of one gradient over all replicas into replica 0, pairing replicas as a binary tree.
+    void reduceSlice(std::size_t layer, int t, bool biases) {
+        const int threadCount = pool.size();
+        auto flat = [&](int replica) {
+            auto &gradients = replicas[replica].state.workspace.gradients(layer);
+            return biases ? Eigen::Map<VectorT<T>>(gradients.biases.data(), gradients.biases.size())
+                          : Eigen::Map<VectorT<T>>(gradients.weights.data(), gradients.weights.size());
+        };
+        const Eigen::Index size = flat(0).size();
+        const Eigen::Index begin = size * t / threadCount;
+        const Eigen::Index count = size * (t + 1) / threadCount - begin;
+        for (int stride = 1; stride < threadCount; stride *= 2) {
+            for (int i = 0; i + stride < threadCount; i += 2 * stride) {
+                flat(i).segment(begin, count) += flat(i + stride).segment(begin, count);
+            }
+        }
+    }
+};
+
+#endif //PERCEPTRON_DATAPARALLELTRAINER_H
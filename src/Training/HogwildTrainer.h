@@ -0,0 +1,158 @@
+#ifndef PERCEPTRON_HOGWILDTRAINER_H
+#define PERCEPTRON_HOGWILDTRAINER_H
+
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <vector>
+#include "../DataHandling.h"
+#include "../Network/Components.h"
+#include "../Memory/AllocationCounter.h"
+#include "../Metrics/Trace.h"
+#include "../Metrics/TrainingMetrics.h"
+#include "../Parallel/ThreadPool.h"
+#include "TrainingReplica.h"
+
+// Asynchronous lock-free SGD in the style of Hogwild!. Every thread repeatedly claims the next mini-batch of the
+// epoch, computes its gradients in its own replica and applies them to the shared parameters right away, without
+// locks or barriers. Updates of different threads may interleave element by element, and this is deliberate: for
+// small sparse-input MLPs lost updates are rare and barrier-free progress scales better than a synchronous
+// reduction. Results are only reproducible with a single thread. If metrics are given, thread t reports to
+// metrics->thread(t), which must exist.
+template<typename T, typename Master = T>
+class HogwildTrainer {
+public:
+    HogwildTrainer(Network<T, Master> &network, int threadCount, int batchSize,
+                   Metrics::TrainingMetrics *metrics = nullptr)
+            : network(network), pool(threadCount), batchSize(batchSize), metrics(metrics) {
+        Eigen::initParallel();
+        workers.reserve(threadCount);
+        for (int t = 0; t < threadCount; ++t) {
+            workers.push_back({TrainingReplica<T, Master>(network, batchSize), {}, {}, 0, 0, 0, {}, {}});
+        }
+    }
+
+    // Trains one epoch over the mapped images and labels of loader, visiting them in the given order. The loss is
+    // computed on every lossInterval-th batch only; returns its mean over those rows.
+    double trainEpoch(const MNISTLoader<T> &loader, const std::vector<int> &order, Master learningRate,
+                      int lossInterval = 1) {
+        using Clock = std::chrono::steady_clock;
+        const auto epochStart = Clock::now();
+        const int count = loader.imageCount();
+        const int batches = (count + batchSize - 1) / batchSize;
+        std::atomic<int> nextBatch{0};
+
+        pool.run([&](int t) {
+            const auto start = Clock::now();
+            Worker &worker = workers[t];
+            Metrics::ThreadCounters *counters = metrics ? &metrics->thread(t) : nullptr;
+            worker.lossSum = 0;
+            worker.lossRows = 0;
+            for (int batch; (batch = nextBatch.fetch_add(1, std::memory_order_relaxed)) < batches;) {
+                const Memory::AllocationStats batchAllocations = Memory::threadAllocations();
+                const int first = batch * batchSize;
+                const int rows = std::min(batchSize, count - first);
+                auto images = worker.images.view(rows, loader.imageSize());
+                auto labels = worker.labels.view(rows, network.outputSize());
+                {
+                    Metrics::ScopedPhase phase(counters, Metrics::Phase::Data);
+                    TRACE_SCOPE("batch_copy");
+                    loader.gatherImageBatch(order.data() + first, rows, images);
+                    loader.gatherLabelBatch(order.data() + first, rows, labels);
+                }
+
+                const bool computeLoss = batch % lossInterval == 0;
+                worker.lossSum += worker.state.computeGradients(network, images, labels, counters, computeLoss);
+                worker.lossRows += computeLoss ? rows : 0;
+                {
+                    Metrics::ScopedPhase phase(counters, Metrics::Phase::Update);
+                    network.normalizeGradients(worker.state.workspace, rows);
+                    // Unsynchronized update of the shared parameters
+                    network.updateWeights(learningRate, worker.state.workspace);
+                }
+
+                const Memory::AllocationStats allocations = Memory::threadAllocations() - batchAllocations;
+                if (worker.batches > 0) {
+                    worker.allocations += allocations;
+                }
+                ++worker.batches;
+                if (counters) {
+                    Metrics::ThreadCounters::add(counters->samples, static_cast<std::uint64_t>(rows));
+                    Metrics::ThreadCounters::add(counters->batches, 1);
+                    Metrics::ThreadCounters::add(counters->allocations, allocations.count);
+                }
+            }
+            worker.busy += Clock::now() - start;
+        });
+
+        double lossSum = 0;
+        long long lossRows = 0;
+        for (const auto &worker : workers) {
+            lossSum += worker.lossSum;
+            lossRows += worker.lossRows;
+        }
+        samples += count;
+        wallTime += Clock::now() - epochStart;
+        return lossRows > 0 ? lossSum / static_cast<double>(lossRows) : 0.0;
+    }
+
+    [[nodiscard]] int threadCount() const { return pool.size(); }
+
+    // Heap allocations made by the worker threads for every batch but each thread's first.
+    [[nodiscard]] Memory::AllocationStats steadyStateAllocations() const {
+        Memory::AllocationStats total;
+        for (const auto &worker : workers) {
+            total += worker.allocations;
+        }
+        return total;
+    }
+
+    // Batches processed after each thread's first one.
+    [[nodiscard]] long long steadyStateSteps() const {
+        long long total = 0;
+        for (const auto &worker : workers) {
+            total += std::max(worker.batches - 1, 0LL);
+        }
+        return total;
+    }
+
+    [[nodiscard]] double samplesPerSecond() const {
+        const double seconds = std::chrono::duration<double>(wallTime).count();
+        return seconds > 0 ? static_cast<double>(samples) / seconds : 0.0;
+    }
+
+    // Fraction of the available thread time (wall time x threads) spent processing batches. Utilization, not
+    // scaling: see DataParallelTrainer::busyFraction.
+    [[nodiscard]] double busyFraction() const {
+        std::chrono::steady_clock::duration busy{};
+        for (const auto &worker : workers) {
+            busy += worker.busy;
+        }
+        const double available = std::chrono::duration<double>(wallTime).count() * pool.size();
+        return available > 0 ? std::chrono::duration<double>(busy).count() / available : 0.0;
+    }
+
+private:
+    struct Worker {
+        TrainingReplica<T, Master> state;
+        Buffer<T> images;
+        Buffer<T> labels;
+        double lossSum = 0;
+        long long lossRows = 0;
+        long long batches = 0;
+        std::chrono::steady_clock::duration busy{};
+        Memory::AllocationStats allocations;
+    };
+
+    Network<T, Master> &network;
+    ThreadPool pool;
+    int batchSize;
+    Metrics::TrainingMetrics *metrics;
+    std::vector<Worker> workers;
+    long long samples = 0;
+    std::chrono::steady_clock::duration wallTime{};
+};
+
+#endif //PERCEPTRON_HOGWILDTRAINER_H
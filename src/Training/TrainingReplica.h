@@ -0,0 +1,60 @@
+#ifndef PERCEPTRON_TRAININGREPLICA_H
+#define PERCEPTRON_TRAININGREPLICA_H
+
+#pragma once
+
+#include "../Network/Components.h"
+#include "../Metrics/Trace.h"
+#include "../Metrics/TrainingMetrics.h"
+
+// Per-thread training state: a network workspace plus the buffers needed to evaluate the softmax
+// cross-entropy loss on up to batchSize rows. The parameters stay in the shared Network.
+template<typename T, typename Master = T>
+struct TrainingReplica {
+    typename Network<T, Master>::Workspace workspace;
+    Buffer<T> gradOutput;
+    VectorT<T> loss;
+    // Multiply-add FLOPs of forward and backward for one row
+    std::uint64_t flopsPerSample = 0;
+
+    TrainingReplica(const Network<T, Master> &network, int batchSize)
+            : workspace(network.makeWorkspace(batchSize)), loss(batchSize) {
+        gradOutput.reserve(static_cast<Eigen::Index>(batchSize) * network.outputSize());
+        for (std::size_t l = 0; l < network.layerCount(); ++l) {
+            const auto &layer = network.layer(l);
+            const auto size = static_cast<std::uint64_t>(layer.inputSize() * layer.outputSize());
+            // Forward and weight gradient, plus the input gradient for all but the first layer
+            flopsPerSample += 2 * size * (l == 0 ? 2 : 3);
+        }
+    }
+
+    // Runs forward, loss and backward on the rows, leaving the gradients summed over the rows in workspace.
+    // Returns the loss summed over the rows, or 0 without computing it if computeLoss is false. The phase times and
+    // FLOPs are added to counters if given.
+    double computeGradients(const Network<T, Master> &network, ConstMatrixRef<T> images, ConstMatrixRef<T> labels,
+                            Metrics::ThreadCounters *counters = nullptr, bool computeLoss = true) {
+        const Eigen::Index rows = images.rows();
+        auto grad = gradOutput.view(rows, network.outputSize());
+        auto rowLoss = loss.head(rows);
+        {
+            Metrics::ScopedPhase phase(counters, Metrics::Phase::Forward);
+            const auto logits = network.forward(images, workspace);
+            TRACE_SCOPE("loss");
+            if (computeLoss) {
+                Loss::softmaxCrossEntropy<T>(logits, labels, grad, rowLoss);
+            } else {
+                Loss::softmaxCrossEntropy<T>(logits, labels, grad);
+            }
+        }
+        {
+            Metrics::ScopedPhase phase(counters, Metrics::Phase::Backward);
+            network.accumulateGradients(grad, workspace);
+        }
+        if (counters) {
+            Metrics::ThreadCounters::add(counters->flops, flopsPerSample * static_cast<std::uint64_t>(rows));
+        }
+        return computeLoss ? rowLoss.sum() : 0.0;
+    }
+};
+
+#endif //PERCEPTRON_TRAININGREPLICA_H
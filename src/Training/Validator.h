@@ -0,0 +1,152 @@
+#ifndef PERCEPTRON_VALIDATOR_H
+#define PERCEPTRON_VALIDATOR_H
+
+#pragma once
+
+#include <algorithm>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include "../DataHandling.h"
+#include "../Metrics/Trace.h"
+#include "../Network/Components.h"
+#include "../Network/Workspace.h"
+
+// Validates snapshots of the network on a held-out split on a background thread, so training does not stall for
+// evaluation. After an epoch, submit() copies the parameters into a snapshot network and returns; the validation
+// thread evaluates the snapshot while the next epoch trains. The trainer collects the result with wait() after the
+// next epoch, by which time it is normally long finished, so decisions based on it lag one epoch but never depend
+// on timing. The parameters of the most accurate snapshot are kept for the final test pass.
+template<typename T, typename Master = T>
+class Validator {
+public:
+    struct Result {
+        int epoch = 0;
+        double accuracy = 0;
+    };
+
+    // Validates on the records [first, first + count) of loader, chunkSize rows per forward pass. plateaued()
+    // turns true after patience epochs without a better accuracy; never if patience is 0.
+    Validator(const Network<T, Master> &network, const MNISTLoader<T> &loader, int first, int count, int chunkSize,
+              int patience)
+            : loader(loader), first(first), count(count), chunkSize(chunkSize), patience(patience), snapshot(network),
+              best(network), workspace(snapshot.makeWorkspace(chunkSize)) {
+        chunk.reserve(static_cast<Eigen::Index>(chunkSize) * loader.imageSize());
+        worker = std::thread(&Validator::validate, this);
+    }
+
+    Validator(const Validator &other) = delete;
+    Validator &operator=(const Validator &other) = delete;
+
+    ~Validator() {
+        {
+            std::lock_guard lock(mutex);
+            stopping = true;
+        }
+        wakeup.notify_one();
+        worker.join();
+    }
+
+    // Hands a snapshot of the network's parameters after the given epoch to the validation thread. Waits for the
+    // previous snapshot first.
+    void submit(const Network<T, Master> &network, int epoch) {
+        wait();
+        copyParameters(network, snapshot);
+        {
+            std::lock_guard lock(mutex);
+            snapshotEpoch = epoch;
+            pending = true;
+        }
+        wakeup.notify_one();
+    }
+
+    // Waits until the last submitted snapshot is validated and returns all results, in epoch order. The results
+    // and the accessors below stay unchanged until the next submit().
+    const std::vector<Result> &wait() {
+        std::unique_lock lock(mutex);
+        idle.wait(lock, [this] { return !pending; });
+        return history;
+    }
+
+    // Whether the last patience results did not improve on the best one.
+    [[nodiscard]] bool plateaued() const {
+        return patience > 0 && !history.empty() && history.back().epoch - bestSoFar.epoch >= patience;
+    }
+
+    // The most accurate result, and the network holding the parameters it was measured with.
+    [[nodiscard]] const Result &bestResult() const { return bestSoFar; }
+    [[nodiscard]] const Network<T, Master> &bestNetwork() const { return best; }
+
+    // Copies the parameters between two networks of the same shape; does not allocate.
+    static void copyParameters(const Network<T, Master> &from, Network<T, Master> &to) {
+        for (std::size_t l = 0; l < from.layerCount(); ++l) {
+            to.layer(l).setParameters(from.layer(l).parameterWeights(), from.layer(l).parameterBiases());
+        }
+    }
+
+private:
+    const MNISTLoader<T> &loader;
+    const int first;
+    const int count;
+    const int chunkSize;
+    const int patience;
+    Network<T, Master> snapshot;   // Parameters being validated; written by submit() only while idle
+    Network<T, Master> best;       // Parameters of bestSoFar
+    typename Network<T, Master>::Workspace workspace;
+    Buffer<T> chunk;
+    std::thread worker;
+    std::mutex mutex;              // Guards the members below
+    std::condition_variable wakeup;
+    std::condition_variable idle;
+    bool stopping = false;
+    bool pending = false;          // A snapshot was submitted and is not validated yet
+    int snapshotEpoch = 0;
+    std::vector<Result> history;
+    Result bestSoFar;
+
+    void validate() {
+        TRACE_THREAD_NAME("Validator");
+        std::unique_lock lock(mutex);
+        while (true) {
+            wakeup.wait(lock, [this] { return stopping || pending; });
+            if (stopping) {
+                return;
+            }
+            const int epoch = snapshotEpoch;
+            lock.unlock();
+            TRACE_SCOPE("validate");
+            const Result result{epoch, accuracy()};
+            const bool improved = history.empty() || result.accuracy > bestSoFar.accuracy;
+            if (improved) {
+                copyParameters(snapshot, best);
+            }
+            lock.lock();
+            history.push_back(result);
+            if (improved) {
+                bestSoFar = result;
+            }
+            pending = false;
+            idle.notify_all();
+        }
+    }
+
+    // Fraction of the held-out records the snapshot classifies correctly, predicting the argmax of the logits.
+    double accuracy() {
+        int correct = 0;
+        for (int i = 0; i < count; i += chunkSize) {
+            const int rows = std::min(chunkSize, count - i);
+            auto images = chunk.view(rows, loader.imageSize());
+            loader.copyImageBatch(first + i, rows, images);
+            const auto logits = snapshot.forward(images, workspace);
+            for (int j = 0; j < rows; ++j) {
+                Eigen::Index prediction;
+                logits.row(j).maxCoeff(&prediction);
+                correct += static_cast<int>(prediction) == loader.rawLabel(first + i + j);
+            }
+        }
+        return count > 0 ? static_cast<double>(correct) / count : 0.0;
+    }
+};
+
+#endif //PERCEPTRON_VALIDATOR_H
@@ -0,0 +1,262 @@
+#ifndef PERCEPTRON_AUTOTUNER_H
+#define PERCEPTRON_AUTOTUNER_H
+
+#pragma once
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <fstream>
+#include <optional>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <type_traits>
+#include <vector>
+#include "../Compute/Gemm.h"
+#include "../DataHandling.h"
+#include "../Network/Components.h"
+#include "../Network/SparseInput.h"
+#include "../Training/DataParallelTrainer.h"
+
+// Startup autotuning of the synchronous training step. Short timed runs of DataParallelTrainer::step on real
+// training images pick the kernel variant (compute backend and sparse first-layer mode) at the configured batch
+// size on one thread, then the batch size and thread count for that kernel. Results are kept in a text cache
+// keyed by CPU model, hardware thread count, precision, layer shapes and the configured settings they replace,
+// so later runs on the same machine and topology start with the tuned settings without measuring again.
+namespace Autotune {
+    struct Settings {
+        int batchSize = 0;
+        int threadCount = 1;
+        Compute::Backend backend = Compute::Backend::Eigen;
+        SparseInput::Mode sparseMode = SparseInput::Mode::Off;
+        double samplesPerSecond = 0;
+    };
+
+    // "model name" of the first processor in /proc/cpuinfo, or "unknown".
+    inline std::string cpuModel() {
+        std::ifstream cpuinfo("/proc/cpuinfo");
+        std::string line;
+        while (std::getline(cpuinfo, line)) {
+            if (line.rfind("model name", 0) == 0) {
+                const std::size_t colon = line.find(':');
+                if (colon != std::string::npos) {
+                    std::string model = line.substr(colon + 1);
+                    model.erase(0, model.find_first_not_of(" \t"));
+                    model.erase(model.find_last_not_of(" \t") + 1);
+                    return model;
+                }
+            }
+        }
+        return "unknown";
+    }
+
+    inline int hardwareThreads() {
+        return std::max(1, static_cast<int>(std::thread::hardware_concurrency()));
+    }
+
+    // Cache key of the tuning run for network under config.
+    template<typename T, typename Master>
+    std::string cacheKey(const Network<T, Master> &network, const Utils::Config &config) {
+        std::ostringstream key;
+        key << "cpu=" << cpuModel() << ";threads=" << hardwareThreads() << ";precision=" << config.precision
+            << ";layers=" << network.layer(0).inputSize();
+        for (std::size_t l = 0; l < network.layerCount(); ++l) {
+            key << 'x' << network.layer(l).outputSize();
+        }
+        key << ";batch_size=" << config.batch_size << ";compute_backend=" << config.compute_backend
+            << ";sparse_input=" << SparseInput::modeName(config.sparse_input.mode);
+        return key.str();
+    }
+
+    // Each cache line is the key, a tab and the settings as "name=value" fields.
+    inline std::optional<Settings> lookup(const std::string &path, const std::string &key) {
+        std::ifstream file(path);
+        std::string line;
+        while (std::getline(file, line)) {
+            const std::size_t tab = line.find('\t');
+            if (tab == std::string::npos || line.compare(0, tab, key) != 0 || tab != key.size()) {
+                continue;
+            }
+            Settings settings;
+            std::istringstream fields(line.substr(tab + 1));
+            std::string field;
+            try {
+                while (fields >> field) {
+                    const std::size_t equals = field.find('=');
+                    const std::string name = field.substr(0, equals);
+                    const std::string value = equals == std::string::npos ? "" : field.substr(equals + 1);
+                    if (name == "batch_size") {
+                        settings.batchSize = std::stoi(value);
+                    } else if (name == "num_threads") {
+                        settings.threadCount = std::stoi(value);
+                    } else if (name == "compute_backend") {
+                        settings.backend = Compute::parseBackend(value);
+                    } else if (name == "sparse_input") {
+                        settings.sparseMode = SparseInput::parseMode(value);
+                    } else if (name == "samples_per_s") {
+                        settings.samplesPerSecond = std::stod(value);
+                    }
+                }
+            } catch (const std::exception &) {
+                return std::nullopt;
+            }
+            // An entry from another build may name a backend this binary lacks; tune again then
+            if (settings.batchSize < 1 || settings.threadCount < 1 || !Compute::supported(settings.backend)) {
+                return std::nullopt;
+            }
+            return settings;
+        }
+        return std::nullopt;
+    }
+
+    // Replaces or appends the entry of key. The file is rewritten under a temporary name and renamed, so
+    // concurrent runs never read a partial cache.
+    inline void store(const std::string &path, const std::string &key, const Settings &settings) {
+        std::vector<std::string> lines;
+        {
+            std::ifstream file(path);
+            std::string line;
+            while (std::getline(file, line)) {
+                if (line.compare(0, key.size() + 1, key + '\t') != 0) {
+                    lines.push_back(line);
+                }
+            }
+        }
+        std::ostringstream entry;
+        entry << key << "\tbatch_size=" << settings.batchSize << " num_threads=" << settings.threadCount
+              << " compute_backend=" << Compute::backendName(settings.backend)
+              << " sparse_input=" << SparseInput::modeName(settings.sparseMode)
+              << " samples_per_s=" << static_cast<long long>(settings.samplesPerSecond);
+        lines.push_back(entry.str());
+
+        const std::string temporaryPath = path + ".tmp";
+        {
+            std::ofstream file(temporaryPath, std::ios::trunc);
+            for (const auto &line : lines) {
+                file << line << '\n';
+            }
+            if (!file.flush()) {
+                throw std::runtime_error("Cannot write autotune cache: " + temporaryPath);
+            }
+        }
+        if (std::rename(temporaryPath.c_str(), path.c_str()) != 0) {
+            throw std::runtime_error("Cannot replace autotune cache: " + path);
+        }
+    }
+
+    // Samples per second of training steps on the leading batchSize rows of images with threadCount threads,
+    // the active backend and the given sparse mode. Runs on a copy, so network is left untouched.
+    template<typename T, typename Master>
+    double measure(const Network<T, Master> &network, ConstMatrixRef<T> images, ConstMatrixRef<T> labels,
+                   int batchSize, int threadCount, SparseInput::Mode sparseMode, Master learningRate) {
+        using Clock = std::chrono::steady_clock;
+        constexpr int warmupSteps = 2;
+        constexpr int minSteps = 3;
+        constexpr auto minDuration = std::chrono::milliseconds(50);
+
+        Network<T, Master> trial = network;
+        SparseInput::Settings sparse = network.sparseInput();
+        sparse.mode = sparseMode;
+        trial.setSparseInput(sparse);
+        DataParallelTrainer<T, Master> trainer(trial, threadCount, batchSize);
+        const auto batchImages = images.topRows(batchSize);
+        const auto batchLabels = labels.topRows(batchSize);
+        for (int i = 0; i < warmupSteps; ++i) {
+            trainer.step(batchImages, batchLabels, learningRate, false);
+        }
+        int steps = 0;
+        const auto start = Clock::now();
+        auto elapsed = Clock::duration::zero();
+        while (steps < minSteps || elapsed < minDuration) {
+            trainer.step(batchImages, batchLabels, learningRate, false);
+            ++steps;
+            elapsed = Clock::now() - start;
+        }
+        return static_cast<double>(steps) * batchSize / std::chrono::duration<double>(elapsed).count();
+    }
+
+    // Measures the candidates for network under config and returns the fastest settings: batch sizes from half to
+    // four times batch_size, powers of two up to the hardware thread count, and every supported backend and the
+    // dense and sparse first layer where compute_backend and sparse_input are "auto". Leaves the active backend
+    // unchanged.
+    template<typename T, typename Master>
+    Settings tune(const Network<T, Master> &network, const MNISTLoader<T> &loader, const Utils::Config &config) {
+        constexpr int classes = 10;
+        const auto learningRate = static_cast<Master>(config.learning_rate);
+        const int available = loader.imageCount();
+        std::vector<int> batchSizes;
+        for (const int batch : {config.batch_size / 2, config.batch_size, config.batch_size * 2,
+                                config.batch_size * 4}) {
+            const int candidate = std::min(batch, available);
+            if (candidate >= 1 && std::find(batchSizes.begin(), batchSizes.end(), candidate) == batchSizes.end()) {
+                batchSizes.push_back(candidate);
+            }
+        }
+        std::vector<int> threadCounts;
+        for (int threads = 1; threads < hardwareThreads(); threads *= 2) {
+            threadCounts.push_back(threads);
+        }
+        threadCounts.push_back(hardwareThreads());
+
+        const int rows = *std::max_element(batchSizes.begin(), batchSizes.end());
+        Buffer<T> imageStorage;
+        Buffer<T> labelStorage;
+        auto images = imageStorage.view(rows, loader.imageSize());
+        auto labels = labelStorage.view(rows, classes);
+        loader.copyImageBatch(0, rows, images);
+        loader.copyLabelBatch(0, rows, labels);
+
+        const Compute::Backend configuredBackend = Compute::activeBackend();
+        std::vector<Compute::Backend> backends{configuredBackend};
+        if (config.compute_backend == "auto" && std::is_same_v<T, float>) {
+            backends.clear();
+            for (const auto backend : {Compute::Backend::Eigen, Compute::Backend::Avx2, Compute::Backend::Avx512}) {
+                if (Compute::supported(backend)) {
+                    backends.push_back(backend);
+                }
+            }
+        }
+        std::vector<SparseInput::Mode> sparseModes{network.sparseInput().mode};
+        if (network.sparseInput().mode == SparseInput::Mode::Auto) {
+            sparseModes = {SparseInput::Mode::Off, SparseInput::Mode::On};
+        }
+
+        // Kernel variant at the configured batch size on one thread
+        Settings best;
+        best.batchSize = std::min(config.batch_size, available);
+        for (const auto backend : backends) {
+            Compute::selectBackend(backend);
+            for (const auto sparseMode : sparseModes) {
+                const double samplesPerSecond =
+                        measure<T, Master>(network, images, labels, best.batchSize, 1, sparseMode, learningRate);
+                if (samplesPerSecond > best.samplesPerSecond) {
+                    best.backend = backend;
+                    best.sparseMode = sparseMode;
+                    best.samplesPerSecond = samplesPerSecond;
+                }
+            }
+        }
+
+        // Batch size and thread count with that kernel
+        Compute::selectBackend(best.backend);
+        for (const int batchSize : batchSizes) {
+            for (const int threadCount : threadCounts) {
+                if (threadCount > batchSize || (batchSize == best.batchSize && threadCount == 1)) {
+                    continue;
+                }
+                const double samplesPerSecond = measure<T, Master>(network, images, labels, batchSize, threadCount,
+                                                                   best.sparseMode, learningRate);
+                if (samplesPerSecond > best.samplesPerSecond) {
+                    best.batchSize = batchSize;
+                    best.threadCount = threadCount;
+                    best.samplesPerSecond = samplesPerSecond;
+                }
+            }
+        }
+        Compute::selectBackend(configuredBackend);
+        return best;
+    }
+}
+
+#endif //PERCEPTRON_AUTOTUNER_H
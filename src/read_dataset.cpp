@@ -1,35 +1,211 @@
+#include <array>
+#include <cstdint>
+#include <fstream>
 #include <iostream>
-#include <filesystem>
+#include <sstream>
+#include <string>
+#include <utility>
+#include <vector>
 #include "DataHandling.h"
 
+// Extracts records of an MNIST IDX file:
+//
+//   read_dataset <input> <output> <indices> <is_image> [--format text|idx]
+//
+// <indices> is a comma-separated list of indices and inclusive ranges ("0,7,100-199"), or @<file> to read such
+// items, separated by commas or whitespace, from a file. The input is memory-mapped and only the requested records
+// are touched, so the cost does not depend on the size of the dataset. The text format writes one tensor per record
+// in the format of Utils::writeTensorToFile, in request order; with a single index the output is unchanged from the
+// original one-record tool. The idx format writes the records as a new IDX file of the same kind, which the loader
+// can read again. <output> may be "-" for stdout.
+
+namespace {
+    enum class Format { Text, Idx };
+
+    struct Options {
+        std::string inputPath;
+        std::string outputPath;
+        std::string indices;
+        bool isImage = false;
+        Format format = Format::Text;
+    };
+
+    // Parses the index or inclusive range "first-last" of one item.
+    std::pair<int, int> parseItem(const std::string &item, int count) {
+        const std::size_t dash = item.find('-');
+        const std::string firstText = item.substr(0, dash);
+        const std::string lastText = dash == std::string::npos ? firstText : item.substr(dash + 1);
+        for (const std::string &text : {firstText, lastText}) {
+            if (text.empty() || text.size() > 9 || text.find_first_not_of("0123456789") != std::string::npos) {
+                throw std::invalid_argument("Invalid index: " + item);
+            }
+        }
+        const int first = std::stoi(firstText);
+        const int last = std::stoi(lastText);
+        if (last >= count || first > last) {
+            throw std::out_of_range("Index " + item + " outside of 0-" + std::to_string(count - 1));
+        }
+        return {first, last};
+    }
+
+    void appendIndices(const std::string &items, int count, std::vector<int> &indices) {
+        std::string normalized = items;
+        for (char &c : normalized) {
+            if (c == ',') {
+                c = ' ';
+            }
+        }
+        std::istringstream stream(normalized);
+        std::string item;
+        while (stream >> item) {
+            const auto [first, last] = parseItem(item, count);
+            for (int i = first; i <= last; ++i) {
+                indices.push_back(i);
+            }
+        }
+    }
+
+    std::vector<int> parseIndices(const std::string &spec, int count) {
+        std::vector<int> indices;
+        if (!spec.empty() && spec[0] == '@') {
+            std::ifstream file(spec.substr(1));
+            if (!file.is_open()) {
+                throw std::runtime_error("Cannot open index file: " + spec.substr(1));
+            }
+            std::string line;
+            while (std::getline(file, line)) {
+                appendIndices(line, count, indices);
+            }
+        } else {
+            appendIndices(spec, count, indices);
+        }
+        if (indices.empty()) {
+            throw std::invalid_argument("No indices given");
+        }
+        return indices;
+    }
+
+    // Text of every possible pixel value, formatted exactly as writeTensorToFile prints the loaded pixel.
+    std::array<std::string, 256> pixelTexts() {
+        std::array<std::string, 256> texts;
+        for (int value = 0; value < 256; ++value) {
+            std::ostringstream text;
+            text << static_cast<Precision>(value / 255.0) << '\n';
+            texts[value] = text.str();
+        }
+        return texts;
+    }
+
+    void writeBigEndian(std::ostream &out, int value) {
+        const auto bytes = __builtin_bswap32(static_cast<std::uint32_t>(value));
+        out.write(reinterpret_cast<const char *>(&bytes), 4);
+    }
+
+    // writeTensorToFile prints the column-major reshape of a record column by column, which is the record's
+    // storage order; labels are one-hot vectors of length 10.
+    void writeText(std::ostream &out, const MNISTLoader<> &loader, const std::vector<int> &indices, bool isImage) {
+        if (isImage) {
+            const auto texts = pixelTexts();
+            const std::string header =
+                    "2\n" + std::to_string(loader.rows()) + "\n" + std::to_string(loader.cols()) + "\n";
+            for (const int index : indices) {
+                out << header;
+                const unsigned char *pixels = loader.rawImage(index);
+                for (int j = 0; j < loader.imageSize(); ++j) {
+                    out << texts[pixels[j]];
+                }
+            }
+        } else {
+            for (const int index : indices) {
+                out << "1\n10\n";
+                const int label = loader.rawLabel(index);
+                for (int j = 0; j < 10; ++j) {
+                    out << (j == label ? "1\n" : "0\n");
+                }
+            }
+        }
+    }
+
+    void writeIdx(std::ostream &out, const MNISTLoader<> &loader, const std::vector<int> &indices, bool isImage) {
+        writeBigEndian(out, isImage ? 2051 : 2049);
+        writeBigEndian(out, static_cast<int>(indices.size()));
+        if (isImage) {
+            writeBigEndian(out, loader.rows());
+            writeBigEndian(out, loader.cols());
+            for (const int index : indices) {
+                out.write(reinterpret_cast<const char *>(loader.rawImage(index)), loader.imageSize());
+            }
+        } else {
+            for (const int index : indices) {
+                out.put(static_cast<char>(loader.rawLabel(index)));
+            }
+        }
+    }
+
+    void extract(const Options &options) {
+        MNISTLoader<> loader;
+        int count;
+        if (options.isImage) {
+            loader.mapImages(options.inputPath, MappedFile::Access::Random);
+            count = loader.imageCount();
+        } else {
+            loader.mapLabels(options.inputPath, MappedFile::Access::Random);
+            count = loader.labelCount();
+        }
+        const std::vector<int> indices = parseIndices(options.indices, count);
+
+        std::vector<char> buffer(1 << 20);
+        std::ofstream file;
+        if (options.outputPath != "-") {
+            file.rdbuf()->pubsetbuf(buffer.data(), static_cast<std::streamsize>(buffer.size()));
+            file.open(options.outputPath, std::ios::binary);
+            if (!file) {
+                throw std::runtime_error("Failed to create output file: " + options.outputPath);
+            }
+        }
+        std::ostream &out = options.outputPath == "-" ? std::cout : file;
+        if (options.format == Format::Text) {
+            writeText(out, loader, indices, options.isImage);
+        } else {
+            writeIdx(out, loader, indices, options.isImage);
+        }
+        out.flush();
+        if (!out) {
+            throw std::runtime_error("Failed to write output file: " + options.outputPath);
+        }
+    }
+}
+
 int main(const int argc, char *argv[]) {
-    if (argc == 5) {
-        const std::string inputPath = argv[1];
-        const std::string outputPath = argv[2];
-        const int index = std::stoi(argv[3]);
-        const bool isImage = (atoi(argv[4]) != 0);
-
-        try {
-            MNISTLoader loader;
-            if (isImage) {
-                loader.loadImages(inputPath);
-                const auto dataset = loader.images();
-                Utils::writeTensorToFile(dataset.row(index).reshaped(loader.rows(),loader.cols()),outputPath);
-
-            } else {
-                loader.loadLabels(inputPath);
-                int rows = 1;
-                int cols=10;
-                const auto dataset = loader.labels();
-                Utils::writeTensorToFile(dataset.row(index).reshaped(rows,cols),outputPath);
-            }
-
-        } catch (const std::exception &e) {
-            std::cerr << "Error: " << e.what() << "\n";
-        }
-        return 0;
-    } else {
+    Options options;
+    std::vector<std::string> positional;
+    bool valid = true;
+    for (int i = 1; i < argc; ++i) {
+        const std::string argument = argv[i];
+        if (argument == "--format" && i + 1 < argc) {
+            const std::string format = argv[++i];
+            valid = valid && (format == "text" || format == "idx");
+            options.format = format == "idx" ? Format::Idx : Format::Text;
+        } else {
+            positional.push_back(argument);
+        }
+    }
+    if (!valid || positional.size() != 4) {
         std::cout << "incorrect number of arguments" << std::endl;
+        std::cout << "Usage: " << argv[0] << " <input> <output> <indices> <is_image> [--format text|idx]"
+                  << std::endl;
         return -1;
     }
+    options.inputPath = positional[0];
+    options.outputPath = positional[1];
+    options.indices = positional[2];
+    options.isImage = (atoi(positional[3].c_str()) != 0);
+
+    try {
+        extract(options);
+    } catch (const std::exception &e) {
+        std::cerr << "Error: " << e.what() << "\n";
+        return 1;
+    }
+    return 0;
 }